@@ -0,0 +1,291 @@
+#include "downsampler.hpp"
+
+#include <scorep/plugin/util/environment.hpp>
+
+#include <metricq/logger/nitro.hpp>
+#include <metricq/types.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using Log = metricq::logger::nitro::Log;
+
+namespace
+{
+struct Reduction
+{
+    double sum;
+    double min;
+    double max;
+};
+
+// Single pass over a contiguous range, the reductions are vectorized with -fopenmp-simd
+Reduction reduce(const double* values, std::size_t size)
+{
+    double sum = 0.;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+#pragma omp simd reduction(+ : sum) reduction(min : min) reduction(max : max)
+    for (std::size_t i = 0; i < size; i++)
+    {
+        sum += values[i];
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+    }
+    return { sum, min, max };
+}
+
+std::int64_t floor_div(std::int64_t a, std::int64_t b)
+{
+    auto q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+} // namespace
+
+DownsampleConfig DownsampleConfig::from_environment()
+{
+    DownsampleConfig config;
+
+    config.count = std::max(0, std::stoi(scorep::environment_variable::get("AVERAGE", "0")));
+
+    if (auto interval_str = scorep::environment_variable::get("DOWNSAMPLE_INTERVAL");
+        !interval_str.empty())
+    {
+        try
+        {
+            config.interval_ns = metricq::duration_parse(interval_str).count();
+            if (config.interval_ns <= 0)
+            {
+                throw std::out_of_range("");
+            }
+        }
+        catch (std::logic_error&)
+        {
+            Log::error() << "Invalid interval specified in "
+                         << scorep::environment_variable::name("DOWNSAMPLE_INTERVAL")
+                         << ", using windows of " << config.count << " samples.";
+            config.interval_ns = 0;
+        }
+    }
+
+    auto mode = scorep::environment_variable::get("DOWNSAMPLE_MODE", "mean");
+    if (mode == "mean")
+    {
+        config.mode = DownsampleMode::mean;
+    }
+    else if (mode == "min")
+    {
+        config.mode = DownsampleMode::min;
+    }
+    else if (mode == "max")
+    {
+        config.mode = DownsampleMode::max;
+    }
+    else if (mode == "minmax")
+    {
+        config.mode = DownsampleMode::minmax;
+    }
+    else
+    {
+        Log::error() << "Invalid mode specified in "
+                     << scorep::environment_variable::name("DOWNSAMPLE_MODE") << ", using mean.";
+    }
+
+    auto position = scorep::environment_variable::get("DOWNSAMPLE_TIMESTAMP", "end");
+    if (position == "start")
+    {
+        config.position = TimestampPosition::start;
+    }
+    else if (position == "center")
+    {
+        config.position = TimestampPosition::center;
+    }
+    else if (position == "end")
+    {
+        config.position = TimestampPosition::end;
+    }
+    else
+    {
+        Log::error() << "Invalid position specified in "
+                     << scorep::environment_variable::name("DOWNSAMPLE_TIMESTAMP")
+                     << ", using end.";
+    }
+
+    return config;
+}
+
+void Downsampler::add(const ChunkView& chunk, std::vector<DownsampledValue>& out)
+{
+    std::size_t i = 0;
+    while (i < chunk.size)
+    {
+        auto time = chunk.time_ns(i);
+        if (count_ > 0 && config_.interval_ns > 0 && time >= window_end_ns_)
+        {
+            flush(out, false);
+        }
+        if (count_ == 0)
+        {
+            begin_window(time);
+        }
+
+        auto end = window_end(chunk, i);
+        accumulate(chunk, i, end);
+        i = end;
+
+        if (config_.interval_ns == 0 && count_ == config_.count)
+        {
+            flush(out, false);
+        }
+    }
+}
+
+void Downsampler::finish(std::vector<DownsampledValue>& out)
+{
+    if (count_ > 0)
+    {
+        flush(out, true);
+    }
+}
+
+void Downsampler::begin_window(std::int64_t time_ns)
+{
+    first_ns_ = time_ns;
+    if (config_.interval_ns > 0)
+    {
+        window_begin_ns_ = floor_div(time_ns, config_.interval_ns) * config_.interval_ns;
+        window_end_ns_ = window_begin_ns_ + config_.interval_ns;
+    }
+    sum_ = 0.;
+    min_ = std::numeric_limits<double>::infinity();
+    max_ = -std::numeric_limits<double>::infinity();
+    // stay within the window if all values are NaN
+    min_ns_ = time_ns;
+    max_ns_ = time_ns;
+}
+
+// index of the first sample in the chunk that is not part of the current window
+std::size_t Downsampler::window_end(const ChunkView& chunk, std::size_t begin) const
+{
+    if (config_.interval_ns == 0)
+    {
+        return std::min(chunk.size, begin + (config_.count - count_));
+    }
+
+    auto limit = window_end_ns_ - chunk.time_base;
+    if (chunk.offsets == nullptr)
+    {
+        if (chunk.interval == 0)
+        {
+            return chunk.size;
+        }
+        auto end = static_cast<std::size_t>((limit + chunk.interval - 1) / chunk.interval);
+        return std::min(chunk.size, end);
+    }
+    if (limit > std::numeric_limits<std::uint32_t>::max())
+    {
+        return chunk.size;
+    }
+    auto it = std::lower_bound(chunk.offsets + begin, chunk.offsets + chunk.size,
+                               static_cast<std::uint32_t>(limit));
+    return it - chunk.offsets;
+}
+
+void Downsampler::accumulate(const ChunkView& chunk, std::size_t begin, std::size_t end)
+{
+    assert(begin < end);
+    const auto* values = chunk.values + begin;
+    auto size = end - begin;
+    auto reduction = reduce(values, size);
+
+    sum_ += reduction.sum;
+    if (reduction.min < min_)
+    {
+        min_ = reduction.min;
+        if (config_.mode == DownsampleMode::minmax)
+        {
+            min_ns_ = chunk.time_ns(begin + (std::find(values, values + size, min_) - values));
+        }
+    }
+    if (reduction.max > max_)
+    {
+        max_ = reduction.max;
+        if (config_.mode == DownsampleMode::minmax)
+        {
+            max_ns_ = chunk.time_ns(begin + (std::find(values, values + size, max_) - values));
+        }
+    }
+    count_ += size;
+    last_ns_ = chunk.time_ns(end - 1);
+}
+
+void Downsampler::flush(std::vector<DownsampledValue>& out, bool trailing)
+{
+    assert(count_ > 0);
+
+    if (min_ > max_)
+    {
+        // all values were NaN, like the mean
+        min_ = max_ = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    if (config_.mode == DownsampleMode::minmax)
+    {
+        if (min_ns_ == max_ns_)
+        {
+            out.push_back({ min_ns_, min_ });
+        }
+        else if (min_ns_ < max_ns_)
+        {
+            out.push_back({ min_ns_, min_ });
+            out.push_back({ max_ns_, max_ });
+        }
+        else
+        {
+            out.push_back({ max_ns_, max_ });
+            out.push_back({ min_ns_, min_ });
+        }
+        count_ = 0;
+        return;
+    }
+
+    auto begin = config_.interval_ns > 0 ? window_begin_ns_ : first_ns_;
+    auto end = config_.interval_ns > 0 ? window_end_ns_ : last_ns_;
+    std::int64_t time = end;
+    switch (config_.position)
+    {
+    case TimestampPosition::start:
+        time = begin;
+        break;
+    case TimestampPosition::center:
+        time = begin + (end - begin) / 2;
+        break;
+    case TimestampPosition::end:
+        time = end;
+        break;
+    }
+    if (trailing)
+    {
+        // don't extend the data beyond the last sample
+        time = std::min(time, last_ns_);
+    }
+
+    double value = 0.;
+    switch (config_.mode)
+    {
+    case DownsampleMode::mean:
+        value = sum_ / count_;
+        break;
+    case DownsampleMode::min:
+        value = min_;
+        break;
+    case DownsampleMode::max:
+        value = max_;
+        break;
+    case DownsampleMode::minmax:
+        break;
+    }
+    out.push_back({ time, value });
+    count_ = 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "metric_store.hpp"
+
+#include <limits>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+enum class DownsampleMode
+{
+    mean,
+    min,
+    max,
+    minmax // both extremes at the time they occurred, preserves peaks
+};
+
+enum class TimestampPosition
+{
+    start,
+    center,
+    end
+};
+
+struct DownsampleConfig
+{
+    DownsampleMode mode = DownsampleMode::mean;
+    TimestampPosition position = TimestampPosition::end;
+    std::size_t count = 0;        // samples per window
+    std::int64_t interval_ns = 0; // window duration, takes precedence over count
+
+    bool enabled() const
+    {
+        return count > 0 || interval_ns > 0;
+    }
+
+    // Reads AVERAGE and the DOWNSAMPLE_* environment variables
+    static DownsampleConfig from_environment();
+};
+
+struct DownsampledValue
+{
+    std::int64_t time_ns;
+    double value;
+};
+
+// Reduces consecutive windows of samples to one value each (two for minmax).
+// Windows either contain a fixed number of samples or cover fixed intervals aligned to the epoch,
+// like the aggregates of MetricQ. Windows may span multiple chunks, a trailing partial window is
+// emitted by finish().
+class Downsampler
+{
+public:
+    Downsampler(const DownsampleConfig& config) : config_(config)
+    {
+    }
+
+    // Appends the values of all windows completed within the chunk to out
+    void add(const ChunkView& chunk, std::vector<DownsampledValue>& out);
+
+    void finish(std::vector<DownsampledValue>& out);
+
+private:
+    void begin_window(std::int64_t time_ns);
+    std::size_t window_end(const ChunkView& chunk, std::size_t begin) const;
+    void accumulate(const ChunkView& chunk, std::size_t begin, std::size_t end);
+    void flush(std::vector<DownsampledValue>& out, bool trailing);
+
+    DownsampleConfig config_;
+
+    std::size_t count_ = 0;
+    std::int64_t window_begin_ns_ = 0;
+    std::int64_t window_end_ns_ = 0;
+    std::int64_t first_ns_ = 0;
+    std::int64_t last_ns_ = 0;
+    double sum_ = 0.;
+    double min_ = std::numeric_limits<double>::infinity();
+    double max_ = -std::numeric_limits<double>::infinity();
+    std::int64_t min_ns_ = 0;
+    std::int64_t max_ns_ = 0;
+};
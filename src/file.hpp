@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+// Writes all bytes, retrying after interrupts and partial writes. Throws std::system_error.
+inline void write_all(int fd, const void* data, std::size_t bytes)
+{
+    auto* ptr = static_cast<const char*>(data);
+    while (bytes > 0)
+    {
+        auto written = ::write(fd, ptr, bytes);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        ptr += written;
+        bytes -= written;
+    }
+}
+
+// Temporary file next to path that replaces it atomically on commit(), so concurrent readers never
+// see a partial file. It is removed if it is not committed. Throws std::system_error.
+class AtomicFile
+{
+public:
+    explicit AtomicFile(std::string path) : path_(std::move(path)), tmp_(path_ + ".XXXXXX")
+    {
+        fd_ = mkstemp(tmp_.data());
+        if (fd_ == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "create " + tmp_);
+        }
+    }
+
+    ~AtomicFile()
+    {
+        if (fd_ != -1)
+        {
+            close(fd_);
+        }
+        if (!committed_)
+        {
+            unlink(tmp_.c_str());
+        }
+    }
+
+    AtomicFile(const AtomicFile&) = delete;
+    AtomicFile& operator=(const AtomicFile&) = delete;
+
+    int fd() const
+    {
+        return fd_;
+    }
+
+    void commit()
+    {
+        close(fd_);
+        fd_ = -1;
+        if (rename(tmp_.c_str(), path_.c_str()) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "rename to " + path_);
+        }
+        committed_ = true;
+    }
+
+private:
+    std::string path_;
+    std::string tmp_;
+    int fd_ = -1;
+    bool committed_ = false;
+};
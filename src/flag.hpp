@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Boolean environment settings, anything else than these spellings of true is false
+inline bool parse_flag(const std::string& str)
+{
+    return str == "1" || str == "true" || str == "TRUE" || str == "yes" || str == "on";
+}
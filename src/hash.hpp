@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+#include <cstdint>
+
+// FNV-1a, unlike std::hash stable across builds, e.g. for names of files shared between processes
+inline std::uint64_t fnv1a(const std::string& str, std::uint64_t hash = 0xcbf29ce484222325)
+{
+    for (unsigned char c : str)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
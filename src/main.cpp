@@ -2,11 +2,20 @@
 #include "timesync/timesync.hpp"
 #endif
 
+#include "downsampler.hpp"
+#include "flag.hpp"
+#include "metadata_cache.hpp"
+#include "metric_drain.hpp"
+#include "metric_store.hpp"
+#include "node_share.hpp"
+#include "parallel.hpp"
+#include "streaming_sink.hpp"
+#include "tick_transform.hpp"
+
 #include <metricq/logger/nitro.hpp>
 #include <metricq/metadata.hpp>
 #include <metricq/ostream.hpp>
 #include <metricq/simple.hpp>
-#include <metricq/simple_drain.hpp>
 #include <metricq/types.hpp>
 
 #include <scorep/plugin/plugin.hpp>
@@ -14,12 +23,21 @@
 #include <nitro/format.hpp>
 #include <nitro/lang/enumerate.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <map>
+#include <optional>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <unordered_map>
 #include <vector>
 
 #include <cstdint>
+#include <cstdlib>
 
 using namespace scorep::plugin::policy;
 
@@ -44,12 +62,12 @@ struct Metric
 {
     std::string name;
     bool use_timesync;
-    bool use_average;
+    bool use_downsampling;
 };
 
 void replace_all(std::string& str, const std::string& from, const std::string& to)
 {
-    size_t start_pos;
+    size_t start_pos = 0;
     while ((start_pos = str.find(from, start_pos)) != std::string::npos)
     {
         str.replace(start_pos, from.length(), to);
@@ -57,6 +75,46 @@ void replace_all(std::string& str, const std::string& from, const std::string& t
     }
 }
 
+// Selector without surrounding whitespace, empty if there is nothing else
+std::string trim(const std::string& str)
+{
+    auto begin = str.find_first_not_of(" \t");
+    if (begin == std::string::npos)
+    {
+        return {};
+    }
+    auto end = str.find_last_not_of(" \t");
+    return str.substr(begin, end - begin + 1);
+}
+
+// Number of worker threads from THREADS, 0 means one per hardware thread
+unsigned threads_from_environment()
+{
+    try
+    {
+        auto threads = std::stoi(scorep::environment_variable::get("THREADS", "0"));
+        if (threads < 0)
+        {
+            throw std::out_of_range("");
+        }
+        return static_cast<unsigned>(threads);
+    }
+    catch (std::logic_error&)
+    {
+        Log::error() << "Invalid number of threads specified in "
+                     << scorep::environment_variable::name("THREADS")
+                     << ", using one per hardware thread.";
+        return 0;
+    }
+}
+
+// Samples of a metric after time conversion and downsampling, ready to be written
+struct ConvertedMetric
+{
+    std::vector<std::uint64_t> ticks;
+    std::vector<double> values;
+};
+
 template <typename T, typename Policies>
 using handle_oid_policy = object_id<Metric, T, Policies>;
 
@@ -67,7 +125,12 @@ public:
     metricq_plugin()
     : url_(scorep::environment_variable::get("SERVER")),
       token_(scorep::environment_variable::get("TOKEN", "sink-scorep")),
-      average_(std::stoi(scorep::environment_variable::get("AVERAGE", "0")))
+      downsample_(DownsampleConfig::from_environment()),
+      persistent_metadata_(MetadataCache::from_environment()),
+      streaming_(parse_flag(scorep::environment_variable::get("STREAMING", "false"))),
+      node_shared_(parse_flag(scorep::environment_variable::get("NODE_SHARED", "false"))),
+      spill_dir_(scorep::environment_variable::get("SPILL_DIR")),
+      threads_(threads_from_environment())
     {
         metricq::logger::nitro::initialize();
         auto log_verbose = scorep::environment_variable::get("VERBOSE", "WARN");
@@ -77,20 +140,144 @@ public:
     }
 
 private:
-    auto get_metadata(const std::string& s)
+    static bool is_wildcard(const std::string& selector)
+    {
+        return selector.find("*") != std::string::npos;
+    }
+
+    static std::string wildcard_to_regex(std::string selector)
     {
-        std::string selector = s;
-        bool is_regex = (selector.find("*") != std::string::npos);
+        replace_all(selector, ".", "\\.");
+        replace_all(selector, "*", ".*");
+        return selector;
+    }
 
-        if (!is_regex)
+    // Metrics of the map that match the selector
+    static MetadataMap select(const MetadataMap& metadata, const std::string& selector)
+    {
+        MetadataMap result;
+        if (!is_wildcard(selector))
+        {
+            if (auto it = metadata.find(selector); it != metadata.end())
+            {
+                result.insert(*it);
+            }
+            return result;
+        }
+        std::regex regex(wildcard_to_regex(selector));
+        for (const auto& elem : metadata)
         {
-            return metricq::get_metadata(url_, token_, std::vector<std::string>({ selector }));
+            if (std::regex_match(elem.first, regex))
+            {
+                result.insert(elem);
+            }
         }
+        return result;
+    }
 
-        replace_all(selector, ".", "\\.");
-        replace_all(selector, "*", ".*");
-        selector = nitro::format("^{}$") % selector;
-        return metricq::get_metadata(url_, token_, selector);
+    // Resolves all selectors of SCOREP_METRIC_METRICQ_PLUGIN with a single request, so the calls of
+    // get_metric_properties for each of them are lookups instead of round trips to MetricQ.
+    // Exact names are requested as a list, if there are wildcards, all selectors are merged into
+    // one regex instead. Selectors found in the persistent cache are not requested at all.
+    void resolve_metadata()
+    {
+        metadata_resolved_ = true;
+
+        const char* selectors_str = std::getenv("SCOREP_METRIC_METRICQ_PLUGIN");
+        if (selectors_str == nullptr)
+        {
+            return;
+        }
+        // Score-P splits the metrics of a plugin at SCOREP_METRIC_<PLUGIN>_SEP
+        const char* separator_str = std::getenv("SCOREP_METRIC_METRICQ_PLUGIN_SEP");
+        auto separator = separator_str != nullptr && *separator_str ? *separator_str : ',';
+
+        std::vector<std::string> selectors;
+        std::stringstream stream(selectors_str);
+        for (std::string entry; std::getline(stream, entry, separator);)
+        {
+            auto selector = trim(entry);
+            if (selector.empty())
+            {
+                continue;
+            }
+            if (auto cached = persistent_metadata_.load(url_, selector))
+            {
+                metadata_cache_.insert(cached->begin(), cached->end());
+                resolved_selectors_.insert(selector);
+            }
+            else
+            {
+                selectors.push_back(selector);
+            }
+        }
+        if (selectors.empty())
+        {
+            return;
+        }
+
+        MetadataMap metadata;
+        try
+        {
+            if (std::none_of(selectors.begin(), selectors.end(), is_wildcard))
+            {
+                metadata = metricq::get_metadata(url_, token_, selectors);
+            }
+            else
+            {
+                std::string regex;
+                for (const auto& selector : selectors)
+                {
+                    regex += (regex.empty() ? "" : "|") + wildcard_to_regex(selector);
+                }
+                std::string selector = nitro::format("^({})$") % regex;
+                metadata = metricq::get_metadata(url_, token_, selector);
+            }
+        }
+        catch (std::exception& e)
+        {
+            Log::warn() << "failed to get the metadata of all metrics at once: " << e.what();
+            return;
+        }
+        Log::debug() << "resolved " << selectors.size() << " selectors to " << metadata.size()
+                     << " metrics.";
+
+        if (persistent_metadata_.enabled())
+        {
+            // unknown metrics are not cached, they may be added to MetricQ in the meantime
+            for (const auto& selector : selectors)
+            {
+                if (auto selected = select(metadata, selector); !selected.empty())
+                {
+                    persistent_metadata_.store(url_, selector, selected);
+                }
+            }
+        }
+        metadata_cache_.insert(metadata.begin(), metadata.end());
+        resolved_selectors_.insert(selectors.begin(), selectors.end());
+    }
+
+    MetadataMap get_metadata(const std::string& entry)
+    {
+        if (!metadata_resolved_)
+        {
+            resolve_metadata();
+        }
+
+        // normalized like in the batch
+        auto s = trim(entry);
+
+        if (resolved_selectors_.count(s) == 0)
+        {
+            // not part of the batch, e.g. if it failed
+            if (!is_wildcard(s))
+            {
+                return metricq::get_metadata(url_, token_, std::vector<std::string>({ s }));
+            }
+            std::string selector = nitro::format("^{}$") % wildcard_to_regex(s);
+            return metricq::get_metadata(url_, token_, selector);
+        }
+        return select(metadata_cache_, s);
     }
 
 public:
@@ -109,15 +296,33 @@ public:
                 do_cc_time_sync_ = true;
             }
 #endif
-            auto use_average = use_timesync && average_;
-            make_handle(name, Metric{ name, use_timesync, use_average });
+            auto use_downsampling = use_timesync && downsample_.enabled();
+            make_handle(name, Metric{ name, use_timesync, use_downsampling });
 
             auto property = scorep::plugin::metric_property(name, meta.description(), meta.unit())
                                 .value_double();
 
-            if (use_average)
+            if (use_downsampling)
             {
-                property.absolute_last();
+                if (downsample_.mode == DownsampleMode::minmax)
+                {
+                    property.absolute_point();
+                }
+                else
+                {
+                    switch (downsample_.position)
+                    {
+                    case TimestampPosition::start:
+                        property.absolute_next();
+                        break;
+                    case TimestampPosition::center:
+                        property.absolute_point();
+                        break;
+                    case TimestampPosition::end:
+                        property.absolute_last();
+                        break;
+                    }
+                }
             }
             else
             {
@@ -147,6 +352,12 @@ public:
     void add_metric(Metric& metric)
     {
         metrics_.push_back(metric.name);
+        // handles of the same metric share the store and its spill file
+        auto [it, inserted] = metric_data_.try_emplace(metric.name);
+        if (inserted && !spill_dir_.empty())
+        {
+            it->second.spill_to(spill_dir_, metric.name);
+        }
     }
 
     void start()
@@ -180,7 +391,42 @@ public:
                 timeout = std::chrono::hours(1);
             }
         }
-        queue_ = metricq::subscribe(url_, token_, metrics_, timeout);
+        if (node_shared_)
+        {
+            node_share_.join(url_, metrics_,
+                             scorep::environment_variable::get("NODE_SHARED_KEY"));
+        }
+        if (node_share_.role() == NodeRole::follower)
+        {
+            // the begin footprint must not precede the shared data
+            node_share_.wait_for_subscription();
+        }
+
+        // followers get the data of the leader at the end
+        if (node_share_.role() != NodeRole::follower)
+        {
+            try
+            {
+                queue_ = metricq::subscribe(url_, token_, metrics_, timeout);
+            }
+            catch (...)
+            {
+                // the followers get no data then, but don't wait forever
+                node_share_.leave();
+                throw;
+            }
+            if (node_share_.role() == NodeRole::leader)
+            {
+                node_share_.announce_subscription();
+            }
+
+            if (streaming_)
+            {
+                stream_sink_ = std::make_unique<StreamingSink>(token_, queue_, metrics_, timeout,
+                                                               metric_data_);
+                stream_sink_->start(url_);
+            }
+        }
 
 #ifdef ENABLE_TIME_SYNC
         if (do_cc_time_sync_)
@@ -196,101 +442,394 @@ public:
 #ifdef ENABLE_TIME_SYNC
         if (do_cc_time_sync_)
         {
-            cc_time_sync_.sync_end();
+            // spilled chunks can only be read after seal()
+            if (cc_time_sync_.adaptive() && stream_sink_ && spill_dir_.empty())
+            {
+                sync_end_adaptive_();
+            }
+            else
+            {
+                if (cc_time_sync_.adaptive() && !stream_sink_)
+                {
+                    Log::warn() << "Adaptive time sync requires "
+                                << scorep::environment_variable::name("STREAMING");
+                }
+                else if (cc_time_sync_.adaptive())
+                {
+                    Log::warn() << "Adaptive time sync is not possible with "
+                                << scorep::environment_variable::name("SPILL_DIR");
+                }
+                cc_time_sync_.sync_end();
+            }
+        }
+#endif
+
+        if (node_share_.role() == NodeRole::follower)
+        {
+            if (!node_share_.receive(metric_data_))
+            {
+                Log::error() << "no data received from the shared subscription of this node.";
+            }
+        }
+        else
+        {
+            if (node_share_.role() == NodeRole::leader)
+            {
+                node_share_.wait_for_followers();
+            }
+
+            if (stream_sink_)
+            {
+                stream_sink_->finish();
+            }
+
+            data_drain_ = std::make_unique<MetricDrain>(token_, queue_, metric_data_);
+            data_drain_->add(metrics_);
+            data_drain_->connect(url_);
+            Log::debug() << "starting data drain main loop.";
+            data_drain_->main_loop();
+            Log::debug() << "finished data drain main loop.";
+
+            // the drain appended the tail to what was streamed during the measurement
+            stream_sink_.reset();
+        }
+
+        for (auto& [name, store] : metric_data_)
+        {
+            try
+            {
+                store.seal();
+            }
+            catch (std::system_error& e)
+            {
+                Log::error() << "failed to map spilled data for " << name << ": " << e.what();
+                store.clear();
+            }
+        }
+
+        if (node_share_.role() == NodeRole::leader)
+        {
+            node_share_.publish(metric_data_);
+        }
+
+#ifdef ENABLE_TIME_SYNC
+        if (do_cc_time_sync_)
+        {
+            sync_metrics_();
         }
 #endif
 
-        data_drain_ = std::make_unique<metricq::SimpleDrain>(token_, queue_);
-        data_drain_->add(metrics_);
-        data_drain_->connect(url_);
-        Log::debug() << "starting data drain main loop.";
-        data_drain_->main_loop();
-        Log::debug() << "finished data drain main loop.";
+        convert_all_values_();
+    }
 
 #ifdef ENABLE_TIME_SYNC
+    // Shortens the end sync phase based on the data streamed for the first high-rate metric
+    void sync_end_adaptive_()
+    {
+        std::string name;
         for (auto& metric : get_handles())
         {
-            // XXX sync with first metric
-            if (metric.use_timesync && !cc_synced_)
+            if (metric.use_timesync)
             {
-                try
-                {
-                    Log::debug() << "Trying timesync with metric: " << metric.name;
-                    auto& data = data_drain_->at(metric.name);
+                name = metric.name;
+                break;
+            }
+        }
+        cc_time_sync_.sync_end_adaptive([this, &name](auto from, auto to)
+                                        { return stream_sink_->copy_data(name, from, to); });
+    }
 
-                    cc_time_sync_.find_offsets(data);
-                    cc_synced_ = true;
-                }
-                catch (std::exception& e)
+    // Determines the time mappings for all metrics that use time sync
+    void sync_metrics_()
+    {
+        std::vector<const Metric*> candidates;
+        for (auto& metric : get_handles())
+        {
+            if (metric.use_timesync)
+            {
+                candidates.push_back(&metric);
+            }
+        }
+
+        auto find_mapping = [this](const Metric& metric) -> std::optional<timesync::TimeMapping>
+        {
+            try
+            {
+                Log::debug() << "Trying timesync with metric: " << metric.name;
+                return cc_time_sync_.find_offsets(metric_data_.at(metric.name), metric.name);
+            }
+            catch (std::exception& e)
+            {
+                Log::warn() << "Timesync with " << metric.name << " failed with error: "
+                            << e.what();
+                return {};
+            }
+        };
+
+        std::vector<std::optional<timesync::TimeMapping>> mappings(candidates.size());
+        if (cc_time_sync_.mode() == timesync::SyncMode::first)
+        {
+            for (std::size_t i = 0; i < candidates.size(); i++)
+            {
+                mappings[i] = find_mapping(*candidates[i]);
+                if (mappings[i])
                 {
-                    Log::warn() << "Timesync failed with error: " << e.what();
+                    break;
                 }
             }
         }
-#endif
+        else
+        {
+            // each correlation holds several transforms of the full sync phase in memory, and
+            // multithreaded FFTs already use the CPUs on their own
+            auto threads = cc_time_sync_.fft_threads() > 1 ? 1u : threads_;
+            parallel_for(
+                candidates.size(),
+                [&](std::size_t index) { mappings[index] = find_mapping(*candidates[index]); },
+                threads);
+        }
+
+        const timesync::TimeMapping* best = nullptr;
+        for (std::size_t i = 0; i < candidates.size(); i++)
+        {
+            if (mappings[i] && (best == nullptr || mappings[i]->quality > best->quality))
+            {
+                best = &*mappings[i];
+            }
+        }
+        if (best == nullptr)
+        {
+            Log::warn() << "Timesync failed for all metrics, timestamps are not corrected.";
+            return;
+        }
+
+        for (std::size_t i = 0; i < candidates.size(); i++)
+        {
+            const auto& name = candidates[i]->name;
+            if (cc_time_sync_.mode() == timesync::SyncMode::each && mappings[i])
+            {
+                time_mappings_[name] = *mappings[i];
+            }
+            else
+            {
+                // metrics that failed to sync on their own use the best available mapping
+                time_mappings_[name] = *best;
+            }
+            Log::debug() << "Time mapping for " << name << " has quality "
+                         << time_mappings_[name].quality;
+        }
     }
+#endif
 
-    scorep::chrono::ticks convert_time_(metricq::TimePoint time, Metric& metric)
+    scorep::chrono::ticks convert_time_(metricq::TimePoint time, const Metric& metric)
     {
-        if (metric.use_timesync)
-        {
 #ifdef ENABLE_TIME_SYNC
-            return convert_.to_ticks(cc_time_sync_.to_local(time));
-#endif
+        if (auto it = time_mappings_.find(metric.name); it != time_mappings_.end())
+        {
+            return convert_.to_ticks(it->second.to_local(time));
         }
+#endif
 
         return convert_.to_ticks(time);
     }
 
-    template <class Cursor>
-    void get_all_values(Metric& metric, Cursor& c)
+    // Combined conversion from measurement time to ticks for whole chunks of samples, with one
+    // piece per segment of the time mapping
+    PiecewiseTickTransform make_tick_transform_(const Metric& metric, metricq::TimePoint origin)
     {
-        auto& data = data_drain_->at(metric.name);
-        if (data.empty())
+        const metricq::Duration span = std::chrono::hours(1);
+        auto ticks_per_ns =
+            static_cast<std::int64_t>(convert_.to_ticks(origin + span).count() -
+                                      convert_.to_ticks(origin).count()) /
+            static_cast<double>(span.count());
+
+        PiecewiseTickTransform transform;
+#ifdef ENABLE_TIME_SYNC
+        if (auto it = time_mappings_.find(metric.name); it != time_mappings_.end())
         {
-            Log::error() << "no measurement data recorded for " << metric.name;
-            return;
+            const auto& mapping = it->second;
+            for (std::size_t i = 0; i < mapping.segments.size(); i++)
+            {
+                // the origin of each piece is within its segment, except for data before it
+                auto piece_origin = std::max(origin, mapping.begins[i]);
+                transform.add(
+                    mapping.begins[i].time_since_epoch().count(),
+                    TickTransform(piece_origin.time_since_epoch().count(),
+                                  convert_.to_ticks(mapping.segments[i].to_local(piece_origin))
+                                      .count(),
+                                  ticks_per_ns * mapping.segments[i].time_rate));
+            }
+            return transform;
         }
+#endif
+        transform.add(origin.time_since_epoch().count(),
+                      TickTransform(origin.time_since_epoch().count(),
+                                    convert_time_(origin, metric).count(), ticks_per_ns));
+        return transform;
+    }
 
-        if (metric.use_average)
+    // Calls write(ticks, values, count) for consecutive batches of (downsampled) samples
+    template <typename W>
+    void convert_values_(const Metric& metric, W&& write)
+    {
+        const auto& data = metric_data_.at(metric.name);
+        auto transform = make_tick_transform_(metric, data.chunk(0).time(0));
+        if (metric.use_downsampling)
         {
-            int count = 0;
-            double sum = 0.;
-            for (auto& tv : data)
+            Downsampler downsampler(downsample_);
+            std::vector<DownsampledValue> downsampled;
+            std::vector<std::uint64_t> ticks;
+            std::vector<double> values;
+            auto write_downsampled = [&]()
             {
-                sum += tv.value;
-                count++;
-                if (count == average_)
+                ticks.clear();
+                values.clear();
+                for (const auto& elem : downsampled)
                 {
-                    c.write(convert_time_(tv.time, metric), sum / average_);
-                    count = 0;
-                    sum = 0.;
+                    ticks.push_back(transform(elem.time_ns));
+                    values.push_back(elem.value);
                 }
-            }
+                write(ticks.data(), values.data(), ticks.size());
+                downsampled.clear();
+            };
+            data.for_each_chunk(
+                [&](const ChunkView& chunk)
+                {
+                    downsampler.add(chunk, downsampled);
+                    write_downsampled();
+                });
+            downsampler.finish(downsampled);
+            write_downsampled();
         }
         else
         {
-            for (auto& tv : data)
+            std::vector<std::uint64_t> ticks;
+            data.for_each_chunk(
+                [&](const ChunkView& chunk)
+                {
+                    ticks.resize(chunk.size);
+                    transform(chunk, ticks.data());
+                    write(ticks.data(), chunk.values, chunk.size);
+                });
+        }
+    }
+
+    // Downsamples the data of all metrics that use it in parallel, so get_all_values only has to
+    // copy. The other metrics are converted chunk by chunk while writing, converting them in
+    // advance would take 16 bytes per sample on top of the stores.
+    void convert_all_values_()
+    {
+        std::vector<const Metric*> handles;
+        for (auto& metric : get_handles())
+        {
+            // several handles of the same metric share the store
+            if (metric.use_downsampling && !metric_data_.at(metric.name).empty() &&
+                converted_data_.count(metric.name) == 0)
+            {
+                handles.push_back(&metric);
+                converted_data_[metric.name];
+            }
+        }
+
+        Log::debug() << "downsampling data of " << handles.size() << " metrics.";
+        std::vector<char> failed(handles.size(), false);
+        parallel_for(
+            handles.size(),
+            [this, &handles, &failed](std::size_t index)
+            {
+                const auto& metric = *handles[index];
+                auto& store = metric_data_.at(metric.name);
+                auto& converted = converted_data_.at(metric.name);
+                try
+                {
+                    convert_values_(metric,
+                                    [&converted](const std::uint64_t* ticks, const double* values,
+                                                 std::size_t count)
+                                    {
+                                        converted.ticks.insert(converted.ticks.end(), ticks,
+                                                               ticks + count);
+                                        converted.values.insert(converted.values.end(), values,
+                                                                values + count);
+                                    });
+                }
+                catch (std::exception& e)
+                {
+                    Log::error() << "failed to convert the data of " << metric.name << ": "
+                                 << e.what();
+                    failed[index] = true;
+                    return;
+                }
+                store.clear();
+            },
+            threads_);
+
+        // the data of these is converted again while writing
+        for (std::size_t i = 0; i < handles.size(); i++)
+        {
+            if (failed[i])
             {
-                c.write(convert_time_(tv.time, metric), tv.value);
+                converted_data_.erase(handles[i]->name);
             }
         }
+        Log::debug() << "finished downsampling data.";
+    }
+
+    template <class Cursor>
+    void get_all_values(Metric& metric, Cursor& c)
+    {
+        // kept for other handles of the same metric, downsampled data is small
+        if (auto it = converted_data_.find(metric.name); it != converted_data_.end())
+        {
+            const auto& converted = it->second;
+            for (std::size_t i = 0; i < converted.ticks.size(); i++)
+            {
+                c.write(scorep::chrono::ticks(converted.ticks[i]), converted.values[i]);
+            }
+            return;
+        }
+
+        if (metric_data_.at(metric.name).empty())
+        {
+            Log::error() << "no measurement data recorded for " << metric.name;
+            return;
+        }
+
+        convert_values_(metric,
+                        [&c](const std::uint64_t* ticks, const double* values, std::size_t count)
+                        {
+                            for (std::size_t i = 0; i < count; i++)
+                            {
+                                c.write(scorep::chrono::ticks(ticks[i]), values[i]);
+                            }
+                        });
     }
 
 private:
-    int average_;
     std::vector<std::string> metrics_;
     std::string url_;
     std::string token_;
+    DownsampleConfig downsample_;
+    MetadataCache persistent_metadata_;
+    bool streaming_;
+    bool node_shared_;
+    std::string spill_dir_;
+    unsigned threads_;
     std::string queue_;
-    std::map<std::string, std::vector<metricq::TimeValue>> metric_data_;
+    bool metadata_resolved_ = false;
+    std::set<std::string> resolved_selectors_;
+    MetadataMap metadata_cache_;
+    // declared before the stores, which may refer to its mapping
+    NodeShare node_share_;
+    std::map<std::string, MetricStore> metric_data_;
+    std::map<std::string, ConvertedMetric> converted_data_;
     scorep::chrono::time_convert<> convert_;
 #ifdef ENABLE_TIME_SYNC
     bool do_cc_time_sync_ = false;
     timesync::CCTimeSync cc_time_sync_;
-    bool cc_synced_ = false;
+    std::map<std::string, timesync::TimeMapping> time_mappings_;
 #endif
-    std::unique_ptr<metricq::SimpleDrain> data_drain_;
+    std::unique_ptr<StreamingSink> stream_sink_;
+    std::unique_ptr<MetricDrain> data_drain_;
 };
 
 SCOREP_METRIC_PLUGIN_CLASS(metricq_plugin, "metricq")
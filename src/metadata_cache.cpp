@@ -0,0 +1,259 @@
+#include "metadata_cache.hpp"
+#include "file.hpp"
+#include "hash.hpp"
+
+#include <scorep/plugin/util/environment.hpp>
+
+#include <metricq/logger/nitro.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <cmath>
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Log = metricq::logger::nitro::Log;
+
+namespace
+{
+constexpr const char* cache_magic = "metricq-metadata-cache 1";
+
+std::string escape(const std::string& str)
+{
+    std::string result;
+    result.reserve(str.size());
+    for (auto c : str)
+    {
+        switch (c)
+        {
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        default:
+            result += c;
+        }
+    }
+    return result;
+}
+
+std::string unescape(const std::string& str)
+{
+    std::string result;
+    result.reserve(str.size());
+    for (std::size_t i = 0; i < str.size(); i++)
+    {
+        if (str[i] != '\\' || i + 1 == str.size())
+        {
+            result += str[i];
+            continue;
+        }
+        switch (str[++i])
+        {
+        case 't':
+            result += '\t';
+            break;
+        case 'n':
+            result += '\n';
+            break;
+        default:
+            result += str[i];
+        }
+    }
+    return result;
+}
+
+const char* scope_name(metricq::Metadata::Scope scope)
+{
+    switch (scope)
+    {
+    case metricq::Metadata::Scope::last:
+        return "last";
+    case metricq::Metadata::Scope::next:
+        return "next";
+    case metricq::Metadata::Scope::point:
+        return "point";
+    case metricq::Metadata::Scope::unknown:
+        break;
+    }
+    return "unknown";
+}
+
+std::vector<std::string> split_fields(const std::string& line)
+{
+    std::vector<std::string> fields;
+    std::size_t begin = 0;
+    for (auto end = line.find('\t'); end != std::string::npos; end = line.find('\t', begin))
+    {
+        fields.push_back(unescape(line.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+    fields.push_back(unescape(line.substr(begin)));
+    return fields;
+}
+} // namespace
+
+MetadataCache::MetadataCache(std::string directory, metricq::Duration ttl)
+: directory_(std::move(directory)), ttl_(ttl)
+{
+}
+
+MetadataCache MetadataCache::from_environment()
+{
+    auto directory = scorep::environment_variable::get("METADATA_CACHE");
+    if (directory.empty())
+    {
+        return {};
+    }
+
+    metricq::Duration ttl = std::chrono::hours(24);
+    if (auto ttl_str = scorep::environment_variable::get("METADATA_CACHE_TTL"); !ttl_str.empty())
+    {
+        try
+        {
+            ttl = metricq::duration_parse(ttl_str);
+            if (ttl.count() <= 0)
+            {
+                throw std::out_of_range("");
+            }
+        }
+        catch (std::logic_error&)
+        {
+            Log::error() << "Invalid TTL specified in "
+                         << scorep::environment_variable::name("METADATA_CACHE_TTL")
+                         << ", using 1 day.";
+            ttl = std::chrono::hours(24);
+        }
+    }
+    return MetadataCache(directory, ttl);
+}
+
+std::string MetadataCache::path(const std::string& url, const std::string& selector) const
+{
+    // the URL contains the credentials, so it only goes into the hash
+    std::stringstream name;
+    name << directory_ << "/scorep-metricq-metadata-" << std::hex << std::setw(16)
+         << std::setfill('0') << fnv1a(selector, fnv1a(url + '\n'));
+    return name.str();
+}
+
+std::optional<MetadataMap> MetadataCache::load(const std::string& url,
+                                               const std::string& selector) const
+{
+    if (!enabled())
+    {
+        return std::nullopt;
+    }
+
+    auto file = path(url, selector);
+    struct stat info;
+    if (stat(file.c_str(), &info) != 0)
+    {
+        return std::nullopt;
+    }
+    auto modified = std::chrono::system_clock::from_time_t(info.st_mtime);
+    if (std::chrono::system_clock::now() - modified > ttl_)
+    {
+        Log::debug() << "cached metadata of " << selector << " is outdated";
+        return std::nullopt;
+    }
+
+    std::ifstream stream(file);
+    std::string line;
+    if (!std::getline(stream, line) || line != cache_magic || !std::getline(stream, line) ||
+        unescape(line) != selector)
+    {
+        Log::warn() << "ignoring invalid metadata cache file " << file;
+        return std::nullopt;
+    }
+
+    MetadataMap result;
+    while (std::getline(stream, line))
+    {
+        auto fields = split_fields(line);
+        if (fields.size() != 5)
+        {
+            Log::warn() << "ignoring invalid metadata cache file " << file;
+            return std::nullopt;
+        }
+
+        metricq::Metadata metadata;
+        if (fields[1] != "nan")
+        {
+            metadata.rate(std::strtod(fields[1].c_str(), nullptr));
+        }
+        if (fields[2] == "last")
+        {
+            metadata.scope(metricq::Metadata::Scope::last);
+        }
+        else if (fields[2] == "next")
+        {
+            metadata.scope(metricq::Metadata::Scope::next);
+        }
+        else if (fields[2] == "point")
+        {
+            metadata.scope(metricq::Metadata::Scope::point);
+        }
+        metadata.unit(fields[3]);
+        metadata.description(fields[4]);
+        result.emplace(fields[0], std::move(metadata));
+    }
+    Log::debug() << "loaded metadata of " << result.size() << " metrics for " << selector
+                 << " from " << file;
+    return result;
+}
+
+void MetadataCache::store(const std::string& url, const std::string& selector,
+                          const MetadataMap& metadata) const
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    std::stringstream content;
+    content << std::setprecision(std::numeric_limits<double>::max_digits10);
+    content << cache_magic << '\n' << escape(selector) << '\n';
+    for (const auto& [name, meta] : metadata)
+    {
+        auto rate = meta.rate();
+        content << escape(name) << '\t';
+        if (std::isnan(rate))
+        {
+            content << "nan";
+        }
+        else
+        {
+            content << rate;
+        }
+        content << '\t' << scope_name(meta.scope()) << '\t' << escape(meta.unit()) << '\t'
+                << escape(meta.description()) << '\n';
+    }
+
+    try
+    {
+        AtomicFile file(path(url, selector));
+        auto data = content.str();
+        write_all(file.fd(), data.data(), data.size());
+        file.commit();
+    }
+    catch (std::system_error& e)
+    {
+        Log::warn() << "failed to store the metadata cache for " << selector << ": " << e.what();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <metricq/metadata.hpp>
+#include <metricq/types.hpp>
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+using MetadataMap = std::unordered_map<std::string, metricq::Metadata>;
+
+// On-disk cache of the metadata that a selector resolved to, so jobs can start without asking
+// the MetricQ manager. There is one file per server and selector in the cache directory. Entries
+// are valid until they are older than the TTL, only rate, scope, unit and description are kept.
+class MetadataCache
+{
+public:
+    MetadataCache() = default;
+    MetadataCache(std::string directory, metricq::Duration ttl);
+
+    static MetadataCache from_environment();
+
+    bool enabled() const
+    {
+        return !directory_.empty();
+    }
+
+    std::optional<MetadataMap> load(const std::string& url, const std::string& selector) const;
+
+    // Replaces the entry atomically, so concurrent ranks never read a partial file
+    void store(const std::string& url, const std::string& selector,
+               const MetadataMap& metadata) const;
+
+private:
+    std::string path(const std::string& url, const std::string& selector) const;
+
+    std::string directory_;
+    metricq::Duration ttl_{};
+};
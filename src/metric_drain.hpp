@@ -0,0 +1,29 @@
+#pragma once
+
+#include "metric_store.hpp"
+
+#include <metricq/sink.hpp>
+#include <metricq/types.hpp>
+
+#include <map>
+#include <string>
+
+// Drains the remaining data of a subscription directly into the columnar metric stores.
+class MetricDrain : public metricq::Drain
+{
+public:
+    MetricDrain(const std::string& token, const std::string& queue,
+                std::map<std::string, MetricStore>& data)
+    : metricq::Drain(token, queue), data_(data)
+    {
+    }
+
+protected:
+    void on_data(const std::string& metric, const metricq::DataChunk& chunk) override
+    {
+        data_.at(metric).append_all(chunk);
+    }
+
+private:
+    std::map<std::string, MetricStore>& data_;
+};
@@ -0,0 +1,179 @@
+#include "metric_store.hpp"
+#include "file.hpp"
+
+#include <metricq/logger/nitro.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using Log = metricq::logger::nitro::Log;
+
+MetricStore::~MetricStore()
+{
+    if (mapping_ != nullptr)
+    {
+        munmap(const_cast<char*>(mapping_), spill_size_);
+    }
+    if (spill_fd_ != -1)
+    {
+        close(spill_fd_);
+    }
+}
+
+void MetricStore::spill_to(const std::string& directory, const std::string& name)
+{
+    assert(spill_fd_ == -1);
+    auto sanitized = name;
+    std::replace(sanitized.begin(), sanitized.end(), '/', '_');
+    std::string path = directory + "/scorep-metricq-" + sanitized + ".XXXXXX";
+    spill_fd_ = mkstemp(path.data());
+    if (spill_fd_ == -1)
+    {
+        Log::error() << "failed to create spill file " << path << ": " << strerror(errno)
+                     << ", keeping data for " << name << " in memory.";
+        return;
+    }
+    // the file only lives as long as we keep it open
+    unlink(path.c_str());
+}
+
+void MetricStore::spill(Chunk& chunk)
+{
+    auto file_offset = spill_size_;
+    try
+    {
+        auto values_bytes = chunk.values.size() * sizeof(double);
+        auto offsets_bytes = chunk.offsets.size() * sizeof(std::uint32_t);
+        write_all(spill_fd_, chunk.values.data(), values_bytes);
+        write_all(spill_fd_, chunk.offsets.data(), offsets_bytes);
+        spill_size_ += values_bytes + offsets_bytes;
+        // keep the values of the next chunk aligned
+        static const char padding[sizeof(double)] = {};
+        if (auto rest = spill_size_ % sizeof(double))
+        {
+            write_all(spill_fd_, padding, sizeof(double) - rest);
+            spill_size_ += sizeof(double) - rest;
+        }
+    }
+    catch (std::system_error& e)
+    {
+        Log::error() << "failed to spill data: " << e.what()
+                     << ", keeping the following data in memory.";
+        // don't try again, but previously spilled chunks remain valid
+        spill_failed_ = true;
+        spill_size_ = file_offset;
+        if (ftruncate(spill_fd_, file_offset) != 0)
+        {
+            Log::warn() << "failed to truncate the spill file: " << strerror(errno);
+        }
+        return;
+    }
+
+    chunk.size = chunk.values.size();
+    chunk.file_offset = file_offset;
+    // chunks without a fixed interval may still have no offsets, e.g. with a single sample
+    chunk.has_offsets = !chunk.offsets.empty();
+    chunk.spilled = true;
+    std::vector<double>().swap(chunk.values);
+    std::vector<std::uint32_t>().swap(chunk.offsets);
+}
+
+void MetricStore::seal()
+{
+    if (spill_fd_ == -1 || spill_size_ == 0 || mapping_ != nullptr)
+    {
+        return;
+    }
+    auto* mapping = mmap(nullptr, spill_size_, PROT_READ, MAP_SHARED, spill_fd_, 0);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::system_error(errno, std::generic_category(), "mmap of spill file");
+    }
+    madvise(mapping, spill_size_, MADV_SEQUENTIAL);
+    mapping_ = static_cast<const char*>(mapping);
+}
+
+void MetricStore::clear()
+{
+    chunks_.clear();
+    chunk_begin_.clear();
+    size_ = 0;
+}
+
+void MetricStore::append_mapped(const ChunkView& view)
+{
+    if (view.size == 0)
+    {
+        return;
+    }
+    chunk_begin_.push_back(size_);
+    auto& chunk = chunks_.emplace_back();
+    chunk.time_base = view.time_base;
+    chunk.interval = view.interval;
+    chunk.size = view.size;
+    chunk.mapped_values = view.values;
+    chunk.mapped_offsets = view.offsets;
+    size_ += view.size;
+}
+
+MetricStore::Chunk& MetricStore::open_chunk(std::int64_t time_base)
+{
+    if (spill_fd_ != -1 && !spill_failed_ && !chunks_.empty() &&
+        chunks_.back().mapped_values == nullptr)
+    {
+        spill(chunks_.back());
+    }
+    chunk_begin_.push_back(size_);
+    auto& chunk = chunks_.emplace_back();
+    chunk.time_base = time_base;
+    // grows up to chunk_capacity, so sparse metrics don't pin a full chunk each
+    chunk.values.reserve(initial_chunk_capacity);
+    return chunk;
+}
+
+void MetricStore::append(metricq::TimeValue tv)
+{
+    auto time = tv.time.time_since_epoch().count();
+
+    auto* chunk = chunks_.empty() ? nullptr : &chunks_.back();
+    auto offset = chunk ? time - chunk->time_base : 0;
+    if (chunk == nullptr || chunk->mapped_values != nullptr ||
+        chunk->values.size() == chunk_capacity || offset < 0 ||
+        offset > std::numeric_limits<std::uint32_t>::max())
+    {
+        chunk = &open_chunk(time);
+        offset = 0;
+    }
+
+    auto n = static_cast<std::int64_t>(chunk->values.size());
+    if (n == 1 && offset > 0)
+    {
+        // second sample determines the candidate fixed interval
+        chunk->interval = offset;
+    }
+    else if (n > 0 && chunk->offsets.empty() && offset != n * chunk->interval)
+    {
+        // irregular sample, materialize the offsets for the samples so far
+        chunk->offsets.reserve(chunk->values.capacity());
+        for (std::int64_t i = 0; i < n; i++)
+        {
+            chunk->offsets.push_back(static_cast<std::uint32_t>(i * chunk->interval));
+        }
+        chunk->interval = 0;
+    }
+
+    if (!chunk->offsets.empty())
+    {
+        chunk->offsets.push_back(static_cast<std::uint32_t>(offset));
+    }
+    chunk->values.push_back(tv.value);
+    size_++;
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <metricq/types.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+// Read-only view of a contiguous block of samples within a MetricStore.
+// Timestamps are stored relative to time_base: either implicitly for a fixed interval, or as
+// 32 bit nanosecond offsets in a separate column.
+struct ChunkView
+{
+    std::int64_t time_base;
+    std::int64_t interval; // fixed sampling interval in ns, 0 if offsets are used
+    std::size_t size;
+    const std::uint32_t* offsets;
+    const double* values;
+
+    std::int64_t time_ns(std::size_t i) const
+    {
+        assert(i < size);
+        if (offsets == nullptr)
+        {
+            return time_base + static_cast<std::int64_t>(i) * interval;
+        }
+        return time_base + offsets[i];
+    }
+
+    metricq::TimePoint time(std::size_t i) const
+    {
+        return metricq::TimePoint(metricq::Duration(time_ns(i)));
+    }
+
+    // View of the samples [begin, end)
+    ChunkView slice(std::size_t begin, std::size_t end) const
+    {
+        assert(begin <= end && end <= size);
+        if (offsets == nullptr)
+        {
+            return { time_base + static_cast<std::int64_t>(begin) * interval, interval, end - begin,
+                     nullptr, values + begin };
+        }
+        return { time_base, 0, end - begin, offsets + begin, values + begin };
+    }
+
+    // Index of the first sample at or after time_ns, searching from begin on
+    std::size_t lower_bound(std::int64_t time_ns, std::size_t begin = 0) const
+    {
+        auto end = size;
+        while (begin < end)
+        {
+            auto mid = begin + (end - begin) / 2;
+            if (this->time_ns(mid) < time_ns)
+            {
+                begin = mid + 1;
+            }
+            else
+            {
+                end = mid;
+            }
+        }
+        return begin;
+    }
+};
+
+// Columnar in-memory storage for the samples of one metric.
+// Samples are appended in fixed capacity chunks, so there are no large reallocations and the
+// memory per sample is 8 (fixed-rate) to 12 (irregular) bytes instead of sizeof(TimeValue).
+//
+// Optionally, completed chunks are spilled to a file and replayed via mmap after seal(), so only
+// the currently filled chunk is kept in memory.
+class MetricStore
+{
+public:
+    static constexpr std::size_t chunk_capacity = 1 << 16;
+    static constexpr std::size_t initial_chunk_capacity = 1 << 10;
+
+    class const_iterator;
+
+    MetricStore() = default;
+    ~MetricStore();
+
+    MetricStore(const MetricStore&) = delete;
+    MetricStore& operator=(const MetricStore&) = delete;
+
+    // Spill completed chunks to an anonymous file in the given directory
+    void spill_to(const std::string& directory, const std::string& name);
+
+    // Must be called after the last append and before reading spilled chunks
+    void seal();
+
+    void append(metricq::TimeValue tv);
+
+    // Drops all samples, e.g. if spilled chunks could not be mapped
+    void clear();
+
+    // Appends a complete chunk whose samples stay in memory owned by the caller, e.g. a mapping
+    // shared with other processes. It must outlive the store.
+    void append_mapped(const ChunkView& view);
+
+    template <typename R>
+    void append_all(const R& range)
+    {
+        for (auto tv : range)
+        {
+            append(tv);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::size_t chunk_count() const
+    {
+        return chunks_.size();
+    }
+
+    ChunkView chunk(std::size_t index) const
+    {
+        const auto& c = chunks_[index];
+        if (c.mapped_values != nullptr)
+        {
+            return ChunkView{ c.time_base, c.interval, c.size, c.mapped_offsets, c.mapped_values };
+        }
+        if (c.spilled)
+        {
+            assert(mapping_ != nullptr);
+            auto* base = mapping_ + c.file_offset;
+            auto* values = reinterpret_cast<const double*>(base);
+            auto* offsets =
+                c.has_offsets ? reinterpret_cast<const std::uint32_t*>(values + c.size) : nullptr;
+            return ChunkView{ c.time_base, c.interval, c.size, offsets, values };
+        }
+        return ChunkView{ c.time_base, c.interval, c.values.size(),
+                          c.offsets.empty() ? nullptr : c.offsets.data(), c.values.data() };
+    }
+
+    template <typename F>
+    void for_each_chunk(F&& f) const
+    {
+        for (std::size_t i = 0; i < chunk_count(); i++)
+        {
+            f(chunk(i));
+        }
+    }
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    struct Chunk
+    {
+        std::int64_t time_base;
+        std::int64_t interval = 0;
+        std::vector<std::uint32_t> offsets;
+        std::vector<double> values;
+        bool spilled = false;
+        std::size_t size = 0; // only valid if spilled or mapped
+        std::size_t file_offset = 0;
+        // only valid if spilled, the offsets follow the values in the file
+        bool has_offsets = false;
+        const double* mapped_values = nullptr;
+        const std::uint32_t* mapped_offsets = nullptr;
+    };
+
+    Chunk& open_chunk(std::int64_t time_base);
+    void spill(Chunk& chunk);
+
+    // index of the chunk containing the global sample index
+    std::size_t find_chunk(std::size_t index) const
+    {
+        auto it = std::upper_bound(chunk_begin_.begin(), chunk_begin_.end(), index);
+        assert(it != chunk_begin_.begin());
+        return std::distance(chunk_begin_.begin(), it) - 1;
+    }
+
+    std::vector<Chunk> chunks_;
+    std::vector<std::size_t> chunk_begin_;
+    std::size_t size_ = 0;
+
+    int spill_fd_ = -1;
+    std::size_t spill_size_ = 0;
+    bool spill_failed_ = false;
+    const char* mapping_ = nullptr;
+};
+
+// Random access over all samples of a store, yielding TimeValue by value.
+class MetricStore::const_iterator
+{
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = metricq::TimeValue;
+    using difference_type = std::ptrdiff_t;
+    using reference = metricq::TimeValue;
+
+    struct pointer
+    {
+        metricq::TimeValue tv;
+
+        const metricq::TimeValue* operator->() const
+        {
+            return &tv;
+        }
+    };
+
+    const_iterator() = default;
+
+    const_iterator(const MetricStore* store, std::size_t index) : store_(store), index_(index)
+    {
+        if (index_ < store_->size())
+        {
+            chunk_index_ = store_->find_chunk(index_);
+            chunk_ = store_->chunk(chunk_index_);
+            pos_ = index_ - store_->chunk_begin_[chunk_index_];
+        }
+    }
+
+    reference operator*() const
+    {
+        return metricq::TimeValue(chunk_.time(pos_), chunk_.values[pos_]);
+    }
+
+    pointer operator->() const
+    {
+        return pointer{ **this };
+    }
+
+    reference operator[](difference_type n) const
+    {
+        return *(*this + n);
+    }
+
+    const_iterator& operator++()
+    {
+        index_++;
+        if (++pos_ == chunk_.size && index_ < store_->size())
+        {
+            chunk_ = store_->chunk(++chunk_index_);
+            pos_ = 0;
+        }
+        return *this;
+    }
+
+    const_iterator operator++(int)
+    {
+        auto tmp = *this;
+        ++*this;
+        return tmp;
+    }
+
+    const_iterator& operator--()
+    {
+        return *this -= 1;
+    }
+
+    const_iterator& operator+=(difference_type n)
+    {
+        *this = const_iterator(store_, index_ + n);
+        return *this;
+    }
+
+    const_iterator& operator-=(difference_type n)
+    {
+        return *this += -n;
+    }
+
+    const_iterator operator+(difference_type n) const
+    {
+        return const_iterator(store_, index_ + n);
+    }
+
+    const_iterator operator-(difference_type n) const
+    {
+        return const_iterator(store_, index_ - n);
+    }
+
+    difference_type operator-(const const_iterator& other) const
+    {
+        return static_cast<difference_type>(index_) - static_cast<difference_type>(other.index_);
+    }
+
+    bool operator==(const const_iterator& other) const
+    {
+        return index_ == other.index_;
+    }
+
+    bool operator!=(const const_iterator& other) const
+    {
+        return index_ != other.index_;
+    }
+
+    bool operator<(const const_iterator& other) const
+    {
+        return index_ < other.index_;
+    }
+
+private:
+    const MetricStore* store_ = nullptr;
+    std::size_t index_ = 0;
+    std::size_t chunk_index_ = 0;
+    std::size_t pos_ = 0;
+    ChunkView chunk_{};
+};
+
+inline MetricStore::const_iterator MetricStore::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+inline MetricStore::const_iterator MetricStore::end() const
+{
+    return const_iterator(this, size_);
+}
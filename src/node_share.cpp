@@ -0,0 +1,480 @@
+#include "node_share.hpp"
+#include "file.hpp"
+#include "hash.hpp"
+
+#include <metricq/logger/nitro.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Log = metricq::logger::nitro::Log;
+
+namespace
+{
+constexpr char shared_magic[8] = { 'M', 'Q', 'S', 'H', 'A', 'R', 'E', '\0' };
+constexpr std::uint32_t shared_version = 2;
+
+// The data file starts with the header, followed by the values and offsets of all chunks, the
+// metric names, the metric table and the chunk table. All offsets are relative to the file.
+struct SharedHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t metric_count;
+    std::uint64_t chunk_count;
+    std::uint64_t table_offset;
+    std::uint64_t nonce; // of the election, so followers never map data of an earlier leader
+};
+static_assert(sizeof(SharedHeader) == 40, "unexpected padding in SharedHeader");
+
+struct SharedMetric
+{
+    std::uint64_t name_offset;
+    std::uint64_t name_length;
+    std::uint64_t chunk_begin; // index in the chunk table
+    std::uint64_t chunk_count;
+};
+static_assert(sizeof(SharedMetric) == 32, "unexpected padding in SharedMetric");
+
+struct SharedChunk
+{
+    std::int64_t time_base;
+    std::int64_t interval;
+    std::uint64_t size;
+    std::uint64_t values_offset;
+    std::uint64_t offsets_offset; // 0 if the interval is fixed
+};
+static_assert(sizeof(SharedChunk) == 40, "unexpected padding in SharedChunk");
+
+// Identifies the processes of one job on this node, they share the parent unless there is a
+// batch system to ask
+std::string default_group_key()
+{
+    const char* job = std::getenv("SLURM_JOB_ID");
+    if (job != nullptr)
+    {
+        const char* step = std::getenv("SLURM_STEP_ID");
+        return std::string(job) + "." + (step != nullptr ? step : "");
+    }
+    return std::to_string(getppid());
+}
+
+std::uint64_t make_nonce()
+{
+    std::random_device random;
+    auto nonce = (std::uint64_t(random()) << 32) ^ random();
+    return nonce ^ std::uint64_t(getpid()) ^
+           static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+class SharedWriter
+{
+public:
+    explicit SharedWriter(int fd) : fd_(fd)
+    {
+    }
+
+    std::uint64_t offset() const
+    {
+        return offset_;
+    }
+
+    void write(const void* data, std::size_t bytes)
+    {
+        write_all(fd_, data, bytes);
+        offset_ += bytes;
+    }
+
+    // keeps the following data aligned for direct access through the mapping
+    void align()
+    {
+        static const char padding[sizeof(double)] = {};
+        if (auto rest = offset_ % sizeof(double))
+        {
+            write(padding, sizeof(double) - rest);
+        }
+    }
+
+private:
+    int fd_;
+    std::uint64_t offset_ = 0;
+};
+} // namespace
+
+NodeShare::~NodeShare()
+{
+    if (mapping_ != nullptr)
+    {
+        munmap(const_cast<char*>(mapping_), mapping_size_);
+    }
+    leave();
+}
+
+void NodeShare::join(const std::string& url, const std::vector<std::string>& metrics,
+                     std::string key)
+{
+    if (key.empty())
+    {
+        key = default_group_key();
+    }
+    auto sorted = metrics;
+    std::sort(sorted.begin(), sorted.end());
+    // the URL contains the credentials, so it only goes into the hash
+    auto hash = fnv1a(url + '\n' + key + '\n');
+    for (const auto& metric : sorted)
+    {
+        hash = fnv1a(metric + '\n', hash);
+    }
+
+    std::stringstream path;
+    path << "/dev/shm/scorep-metricq-" << getuid() << "-" << std::hex << std::setw(16)
+         << std::setfill('0') << hash;
+    path_ = path.str();
+
+    lock_fd_ = open((path_ + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd_ == -1)
+    {
+        Log::warn() << "failed to open " << path_ << ".lock: " << strerror(errno)
+                    << ", using an own subscription.";
+        return;
+    }
+
+    if (!lock(Lock::join, F_WRLCK, true))
+    {
+        Log::warn() << "failed to join the shared subscription of this node, using an own "
+                       "subscription.";
+        leave();
+        return;
+    }
+
+    // fails only if the leader is already finishing, then it's too late to join. A finished
+    // leader removes the lock file, which stays in place as long as the running lock is held.
+    struct stat opened;
+    struct stat current;
+    if (!lock(Lock::running, F_RDLCK, false) || !lock(Lock::mapping, F_RDLCK, false) ||
+        fstat(lock_fd_, &opened) != 0 || stat((path_ + ".lock").c_str(), &current) != 0 ||
+        opened.st_dev != current.st_dev || opened.st_ino != current.st_ino)
+    {
+        Log::info() << "the shared subscription of this node is already finishing, using an own "
+                       "subscription.";
+        leave();
+        return;
+    }
+
+    if (lock(Lock::leader, F_WRLCK, false))
+    {
+        if (!lock(Lock::subscribed, F_WRLCK, false) || !elect())
+        {
+            Log::warn() << "failed to lead the shared subscription of this node, using an own "
+                           "subscription.";
+            leave();
+            return;
+        }
+        role_ = NodeRole::leader;
+        unlock(Lock::running);
+        unlock(Lock::mapping);
+        Log::debug() << "leading the shared subscription " << path_;
+    }
+    else
+    {
+        // the leader has written its nonce before it released the join lock
+        if (pread(lock_fd_, &nonce_, sizeof(nonce_), 0) != static_cast<ssize_t>(sizeof(nonce_)))
+        {
+            Log::warn() << "failed to read " << path_ << ".lock, using an own subscription.";
+            leave();
+            return;
+        }
+        role_ = NodeRole::follower;
+        Log::debug() << "following the shared subscription " << path_;
+    }
+    unlock(Lock::join);
+}
+
+bool NodeShare::elect()
+{
+    // a crashed leader or an earlier group with the same key may have left its data behind
+    auto data_path = path_ + ".data";
+    if (unlink(data_path.c_str()) != 0 && errno != ENOENT)
+    {
+        Log::error() << "failed to remove " << data_path << ": " << strerror(errno);
+        return false;
+    }
+    nonce_ = make_nonce();
+    if (pwrite(lock_fd_, &nonce_, sizeof(nonce_), 0) != static_cast<ssize_t>(sizeof(nonce_)))
+    {
+        Log::error() << "failed to write " << path_ << ".lock: " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void NodeShare::announce_subscription()
+{
+    assert(role_ == NodeRole::leader);
+    unlock(Lock::subscribed);
+}
+
+void NodeShare::wait_for_subscription()
+{
+    assert(role_ == NodeRole::follower);
+    Log::debug() << "waiting for the leader to subscribe.";
+    if (!lock(Lock::subscribed, F_RDLCK, true))
+    {
+        Log::warn() << "failed to wait for the shared subscription of this node, using an own "
+                       "subscription.";
+        leave();
+        return;
+    }
+    unlock(Lock::subscribed);
+}
+
+bool NodeShare::lock(Lock which, short type, bool wait)
+{
+    struct flock range = {};
+    range.l_type = type;
+    range.l_whence = SEEK_SET;
+    range.l_start = static_cast<off_t>(which);
+    range.l_len = 1;
+    while (fcntl(lock_fd_, wait ? F_SETLKW : F_SETLK, &range) == -1)
+    {
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EACCES)
+        {
+            Log::error() << "failed to lock " << path_ << ".lock: " << strerror(errno);
+        }
+        return false;
+    }
+    return true;
+}
+
+void NodeShare::unlock(Lock which)
+{
+    lock(which, F_UNLCK, false);
+}
+
+void NodeShare::leave()
+{
+    if (lock_fd_ != -1)
+    {
+        // releases all locks
+        close(lock_fd_);
+        lock_fd_ = -1;
+    }
+    role_ = NodeRole::standalone;
+}
+
+void NodeShare::wait_for_followers()
+{
+    assert(role_ == NodeRole::leader);
+    Log::debug() << "waiting for the followers to stop their measurement.";
+    // also keeps processes that join from now on out of the group
+    if (!lock(Lock::running, F_WRLCK, true))
+    {
+        // publishing now would cut off the data of the followers
+        Log::error() << "failed to wait for the followers, they get no data.";
+        leave();
+    }
+}
+
+void NodeShare::publish(const std::map<std::string, MetricStore>& data)
+{
+    assert(role_ == NodeRole::leader);
+    auto data_path = path_ + ".data";
+    try
+    {
+        AtomicFile file(data_path);
+        SharedWriter writer(file.fd());
+        SharedHeader header = {};
+        writer.write(&header, sizeof(header));
+
+        std::vector<SharedMetric> metrics;
+        std::vector<SharedChunk> chunks;
+        for (const auto& [name, store] : data)
+        {
+            auto& metric = metrics.emplace_back();
+            metric.chunk_begin = chunks.size();
+            store.for_each_chunk(
+                [&](const ChunkView& view)
+                {
+                    auto& chunk = chunks.emplace_back();
+                    chunk.time_base = view.time_base;
+                    chunk.interval = view.interval;
+                    chunk.size = view.size;
+                    chunk.values_offset = writer.offset();
+                    writer.write(view.values, view.size * sizeof(double));
+                    if (view.offsets != nullptr)
+                    {
+                        chunk.offsets_offset = writer.offset();
+                        writer.write(view.offsets, view.size * sizeof(std::uint32_t));
+                        writer.align();
+                    }
+                });
+            metric.chunk_count = chunks.size() - metric.chunk_begin;
+        }
+
+        auto metric = metrics.begin();
+        for (const auto& elem : data)
+        {
+            metric->name_offset = writer.offset();
+            metric->name_length = elem.first.size();
+            writer.write(elem.first.data(), elem.first.size());
+            ++metric;
+        }
+        writer.align();
+
+        std::memcpy(header.magic, shared_magic, sizeof(header.magic));
+        header.version = shared_version;
+        header.metric_count = static_cast<std::uint32_t>(metrics.size());
+        header.chunk_count = chunks.size();
+        header.table_offset = writer.offset();
+        header.nonce = nonce_;
+        writer.write(metrics.data(), metrics.size() * sizeof(SharedMetric));
+        writer.write(chunks.data(), chunks.size() * sizeof(SharedChunk));
+
+        if (pwrite(file.fd(), &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+        {
+            throw std::system_error(errno, std::generic_category(), "write to shared data");
+        }
+        file.commit();
+        Log::debug() << "published " << writer.offset() << " bytes of shared data.";
+    }
+    catch (std::system_error& e)
+    {
+        Log::error() << "failed to publish the shared data: " << e.what()
+                     << ", the followers of this node get no data.";
+    }
+
+    // the file vanishes from /dev/shm once all followers have mapped it
+    unlock(Lock::leader);
+    if (!lock(Lock::mapping, F_WRLCK, true))
+    {
+        Log::error() << "failed to wait for the followers to map the shared data, leaving "
+                     << data_path << " behind.";
+        leave();
+        return;
+    }
+    // processes that still have the lock file open find that it's gone when they join
+    unlink(data_path.c_str());
+    unlink((path_ + ".lock").c_str());
+    leave();
+}
+
+bool NodeShare::receive(std::map<std::string, MetricStore>& data)
+{
+    assert(role_ == NodeRole::follower);
+    unlock(Lock::running);
+    Log::debug() << "waiting for the leader to publish the shared data.";
+    if (!lock(Lock::leader, F_RDLCK, true))
+    {
+        Log::error() << "failed to wait for the leader to publish the shared data.";
+        leave();
+        return false;
+    }
+
+    auto data_path = path_ + ".data";
+    auto fd = open(data_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd != -1 && fstat(fd, &info) == 0 && info.st_size >= 0)
+    {
+        mapping_size_ = static_cast<std::size_t>(info.st_size);
+        auto* mapping = mmap(nullptr, mapping_size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            mapping_ = static_cast<const char*>(mapping);
+        }
+    }
+    auto error = errno;
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    leave();
+
+    if (mapping_ == nullptr)
+    {
+        Log::error() << "failed to map the shared data " << data_path << ": " << strerror(error);
+        return false;
+    }
+
+    auto in_bounds = [this](std::uint64_t offset, std::uint64_t count, std::size_t size)
+    { return offset <= mapping_size_ && count <= (mapping_size_ - offset) / size; };
+
+    SharedHeader header;
+    if (mapping_size_ < sizeof(header))
+    {
+        Log::error() << "invalid shared data in " << data_path;
+        return false;
+    }
+    std::memcpy(&header, mapping_, sizeof(header));
+    if (std::memcmp(header.magic, shared_magic, sizeof(header.magic)) != 0 ||
+        header.version != shared_version || header.nonce != nonce_ ||
+        !in_bounds(header.table_offset, header.metric_count, sizeof(SharedMetric)) ||
+        !in_bounds(header.table_offset + header.metric_count * sizeof(SharedMetric),
+                   header.chunk_count, sizeof(SharedChunk)))
+    {
+        Log::error() << "invalid shared data in " << data_path;
+        return false;
+    }
+
+    auto* metrics = reinterpret_cast<const SharedMetric*>(mapping_ + header.table_offset);
+    auto* chunks = reinterpret_cast<const SharedChunk*>(metrics + header.metric_count);
+    for (std::uint32_t i = 0; i < header.metric_count; i++)
+    {
+        const auto& metric = metrics[i];
+        if (!in_bounds(metric.name_offset, metric.name_length, 1) ||
+            metric.chunk_begin > header.chunk_count ||
+            metric.chunk_count > header.chunk_count - metric.chunk_begin)
+        {
+            Log::error() << "invalid shared data in " << data_path;
+            return false;
+        }
+        std::string name(mapping_ + metric.name_offset, metric.name_length);
+        auto it = data.find(name);
+        if (it == data.end())
+        {
+            continue;
+        }
+
+        for (auto j = metric.chunk_begin; j < metric.chunk_begin + metric.chunk_count; j++)
+        {
+            const auto& chunk = chunks[j];
+            bool has_offsets = chunk.offsets_offset != 0;
+            if (!in_bounds(chunk.values_offset, chunk.size, sizeof(double)) ||
+                (has_offsets &&
+                 !in_bounds(chunk.offsets_offset, chunk.size, sizeof(std::uint32_t))))
+            {
+                Log::error() << "invalid shared data in " << data_path;
+                it->second.clear();
+                return false;
+            }
+            it->second.append_mapped(ChunkView{
+                chunk.time_base, chunk.interval, chunk.size,
+                has_offsets ?
+                    reinterpret_cast<const std::uint32_t*>(mapping_ + chunk.offsets_offset) :
+                    nullptr,
+                reinterpret_cast<const double*>(mapping_ + chunk.values_offset) });
+        }
+    }
+    Log::debug() << "mapped " << mapping_size_ << " bytes of shared data.";
+    return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "metric_store.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+enum class NodeRole
+{
+    standalone, // own subscription, e.g. if sharing is disabled or the group is already finishing
+    leader,     // subscribes and drains for all processes of the node
+    follower    // reads the data of the leader
+};
+
+// Shares one subscription between the processes of a node that measure the same metrics, e.g.
+// the ranks of an MPI job. The first process to join becomes the leader. At the end of the
+// measurement, it waits for all followers to stop, drains the queue and publishes the samples in
+// a file in /dev/shm, which the followers map instead of copying.
+//
+// The processes coordinate via byte-range locks on a lock file, so a crashed process never blocks
+// the others. Processes that join while the leader is already finishing run on their own.
+class NodeShare
+{
+public:
+    NodeShare() = default;
+    ~NodeShare();
+
+    NodeShare(const NodeShare&) = delete;
+    NodeShare& operator=(const NodeShare&) = delete;
+
+    // Joins the group of processes that use the same server, metrics and key. Must be called
+    // before the subscription. Without a key, the processes of the job on this node are grouped.
+    void join(const std::string& url, const std::vector<std::string>& metrics, std::string key);
+
+    // Leaves the group, e.g. if the subscription of the leader failed
+    void leave();
+
+    NodeRole role() const
+    {
+        return role_;
+    }
+
+    // Leader: lets the followers start their measurement, must be called once subscribed
+    void announce_subscription();
+
+    // Follower: blocks until the leader has subscribed, so the shared data covers the whole
+    // measurement of this process
+    void wait_for_subscription();
+
+    // Leader: blocks until all followers have stopped their measurement
+    void wait_for_followers();
+
+    // Leader: publishes the sealed stores and waits until the followers have mapped them
+    void publish(const std::map<std::string, MetricStore>& data);
+
+    // Follower: blocks until the leader has published and attaches the shared chunks to the stores.
+    // Returns false if there is no valid data, e.g. if the leader crashed.
+    bool receive(std::map<std::string, MetricStore>& data);
+
+private:
+    enum class Lock
+    {
+        leader,     // exclusive by the leader until it has published
+        running,    // shared by the followers during their measurement
+        mapping,    // shared by the followers until they have mapped the data
+        subscribed, // exclusive by the leader until it has subscribed
+        join        // exclusive during the election, so the leader is set up before any follower
+    };
+
+    // Leader: removes the data of earlier leaders and starts a new election nonce
+    bool elect();
+    bool lock(Lock which, short type, bool wait);
+    void unlock(Lock which);
+
+    NodeRole role_ = NodeRole::standalone;
+    std::string path_;
+    int lock_fd_ = -1;
+    std::uint64_t nonce_ = 0;
+    const char* mapping_ = nullptr;
+    std::size_t mapping_size_ = 0;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+// Number of worker threads to use, 0 means one per hardware thread
+inline unsigned worker_count(unsigned requested, std::size_t work_items)
+{
+    unsigned count = requested;
+    if (count == 0)
+    {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return static_cast<unsigned>(std::min<std::size_t>(count, work_items));
+}
+
+// Calls f(index) for all indices in [0, count) on up to `threads` worker threads.
+// Work items are handed out dynamically, so uneven items balance out. The first exception thrown
+// by any item is rethrown in the calling thread after all workers are done.
+template <typename F>
+void parallel_for(std::size_t count, F&& f, unsigned threads = 0)
+{
+    threads = worker_count(threads, count);
+    if (threads <= 1)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<std::size_t> next{ 0 };
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&]()
+    {
+        for (auto i = next++; i < count; i = next++)
+        {
+            try
+            {
+                f(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; t++)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,86 @@
+#include "streaming_sink.hpp"
+
+#include <metricq/logger/nitro.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+using Log = metricq::logger::nitro::Log;
+
+StreamingSink::StreamingSink(const std::string& token, const std::string& queue,
+                             const std::vector<std::string>& metrics, metricq::Duration expires,
+                             std::map<std::string, MetricStore>& data)
+: metricq::Sink(token, true), queue_(queue), metrics_(metrics), expires_(expires), data_(data)
+{
+}
+
+StreamingSink::~StreamingSink()
+{
+    finish();
+}
+
+void StreamingSink::start(const std::string& url)
+{
+    connect(url);
+    thread_ = std::thread(
+        [this]()
+        {
+            Log::debug() << "starting streaming sink main loop.";
+            try
+            {
+                main_loop();
+            }
+            catch (std::exception& e)
+            {
+                Log::error() << "streaming sink failed: " << e.what();
+            }
+            Log::debug() << "finished streaming sink main loop.";
+        });
+}
+
+void StreamingSink::finish()
+{
+    if (!thread_.joinable())
+    {
+        return;
+    }
+    io_service.post([this]() { stop(); });
+    thread_.join();
+}
+
+void StreamingSink::on_connected()
+{
+    // Re-subscribing to the existing queue only attaches us as a consumer, the manager keeps
+    // routing the data into the same queue that the final drain will unsubscribe from.
+    rpc(
+        "sink.subscribe", [this](const auto& response) { sink_config(response); },
+        { { "dataQueue", queue_ },
+          { "metrics", metrics_ },
+          { "expires", std::chrono::duration_cast<std::chrono::seconds>(expires_).count() } });
+}
+
+void StreamingSink::on_data(const std::string& metric, const metricq::DataChunk& chunk)
+{
+    std::lock_guard<std::mutex> lock(data_mutex_);
+    data_.at(metric).append_all(chunk);
+}
+
+std::vector<metricq::TimeValue> StreamingSink::copy_data(const std::string& metric,
+                                                         metricq::TimePoint from,
+                                                         metricq::TimePoint to)
+{
+    std::lock_guard<std::mutex> lock(data_mutex_);
+    const auto& store = data_.at(metric);
+    auto it = std::partition_point(store.begin(), store.end(),
+                                   [from](const auto& tv) { return tv.time < from; });
+    std::vector<metricq::TimeValue> result;
+    for (; it != store.end(); ++it)
+    {
+        result.push_back(*it);
+        if (it->time > to)
+        {
+            break;
+        }
+    }
+    return result;
+}
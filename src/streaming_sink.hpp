@@ -0,0 +1,48 @@
+#pragma once
+
+#include "metric_store.hpp"
+
+#include <metricq/sink.hpp>
+#include <metricq/types.hpp>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Consumes the data queue of an existing subscription in a background thread while the
+// measurement is still running and appends it to the metric stores. Unlike metricq::Drain, this
+// does not unsubscribe, so a regular drain can still collect the remaining tail of the queue
+// afterwards.
+class StreamingSink : public metricq::Sink
+{
+public:
+    StreamingSink(const std::string& token, const std::string& queue,
+                  const std::vector<std::string>& metrics, metricq::Duration expires,
+                  std::map<std::string, MetricStore>& data);
+    ~StreamingSink();
+
+    void start(const std::string& url);
+
+    // Stops consuming and waits for the background thread. Messages that have not been
+    // acknowledged until then remain in the queue for the final drain.
+    void finish();
+
+    // Copies the samples streamed so far for the metric within [from, to] and the first one after
+    // to, so computations on them do not block the sink. Must not be used with spilled stores.
+    std::vector<metricq::TimeValue> copy_data(const std::string& metric, metricq::TimePoint from,
+                                              metricq::TimePoint to);
+
+protected:
+    void on_connected() override;
+    void on_data(const std::string& metric, const metricq::DataChunk& chunk) override;
+
+private:
+    std::string queue_;
+    std::vector<std::string> metrics_;
+    metricq::Duration expires_;
+    std::thread thread_;
+    std::mutex data_mutex_;
+    std::map<std::string, MetricStore>& data_;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "metric_store.hpp"
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+// Affine mapping from measurement timestamps to Score-P ticks.
+// Both the linear drift correction of the time synchronization and the Score-P tick conversion
+// are affine, so their composition is applied with a single multiply-add per sample relative to
+// an origin. The loops over a chunk have no calls and no dependencies, so they are vectorized.
+class TickTransform
+{
+public:
+    TickTransform(std::int64_t origin_ns, std::uint64_t origin_ticks, double ticks_per_ns)
+    : origin_ns_(origin_ns), origin_ticks_(origin_ticks), ticks_per_ns_(ticks_per_ns)
+    {
+    }
+
+    std::uint64_t operator()(std::int64_t time_ns) const
+    {
+        // the difference to the origin is exactly representable for runs shorter than 104 days
+        return origin_ticks_ +
+               static_cast<std::int64_t>(static_cast<double>(time_ns - origin_ns_) * ticks_per_ns_);
+    }
+
+    // Converts all timestamps of the chunk into out, which must have room for chunk.size values
+    void operator()(const ChunkView& chunk, std::uint64_t* out) const
+    {
+        const auto base = static_cast<double>(chunk.time_base - origin_ns_);
+        const auto origin_ticks = origin_ticks_;
+        const auto ticks_per_ns = ticks_per_ns_;
+        if (chunk.offsets == nullptr)
+        {
+            const auto start = base * ticks_per_ns;
+            const auto step = static_cast<double>(chunk.interval) * ticks_per_ns;
+            for (std::size_t i = 0; i < chunk.size; i++)
+            {
+                out[i] = origin_ticks +
+                         static_cast<std::int64_t>(start + static_cast<double>(i) * step);
+            }
+        }
+        else
+        {
+            const auto* offsets = chunk.offsets;
+            for (std::size_t i = 0; i < chunk.size; i++)
+            {
+                out[i] = origin_ticks +
+                         static_cast<std::int64_t>((base + offsets[i]) * ticks_per_ns);
+            }
+        }
+    }
+
+private:
+    std::int64_t origin_ns_;
+    std::uint64_t origin_ticks_;
+    double ticks_per_ns_;
+};
+
+// Piecewise affine mapping for time mappings with several segments, each segment is applied from
+// its begin on and the first one also before. Timestamps must be converted in ascending order,
+// so the current segment is tracked instead of looked up, and chunks are only split at the
+// segment boundaries.
+class PiecewiseTickTransform
+{
+public:
+    void add(std::int64_t begin_ns, const TickTransform& transform)
+    {
+        begins_.push_back(begin_ns);
+        pieces_.push_back(transform);
+    }
+
+    std::uint64_t operator()(std::int64_t time_ns)
+    {
+        advance(time_ns);
+        return pieces_[current_](time_ns);
+    }
+
+    void operator()(const ChunkView& chunk, std::uint64_t* out)
+    {
+        std::size_t begin = 0;
+        while (begin < chunk.size)
+        {
+            advance(chunk.time_ns(begin));
+            auto end = current_ + 1 < begins_.size() ?
+                           chunk.lower_bound(begins_[current_ + 1], begin) :
+                           chunk.size;
+            pieces_[current_](chunk.slice(begin, end), out + begin);
+            begin = end;
+        }
+    }
+
+private:
+    void advance(std::int64_t time_ns)
+    {
+        while (current_ + 1 < begins_.size() && begins_[current_ + 1] <= time_ns)
+        {
+            current_++;
+        }
+    }
+
+    std::vector<std::int64_t> begins_;
+    std::vector<TickTransform> pieces_;
+    std::size_t current_ = 0;
+};
@@ -0,0 +1,138 @@
+#include "correlation_dump.hpp"
+
+#include "../file.hpp"
+
+#include <metricq/logger/nitro.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+using Log = metricq::logger::nitro::Log;
+
+namespace
+{
+// Keeps the background writes alive until they are completed, also at exit
+class PendingDumps
+{
+public:
+    ~PendingDumps()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& write : writes_)
+        {
+            write.wait();
+        }
+    }
+
+    void add(std::future<void> write)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // drop the completed ones, so this doesn't grow with every dump
+        writes_.erase(std::remove_if(writes_.begin(), writes_.end(),
+                                     [](const auto& w)
+                                     {
+                                         return w.wait_for(std::chrono::seconds(0)) ==
+                                                std::future_status::ready;
+                                     }),
+                      writes_.end());
+        writes_.push_back(std::move(write));
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::future<void>> writes_;
+};
+
+PendingDumps& pending_dumps()
+{
+    static PendingDumps pending;
+    return pending;
+}
+
+void write_file(const std::string& filename, const std::vector<char>& buffer)
+{
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        Log::error() << "failed to open correlation file " << filename << ": " << strerror(errno);
+        return;
+    }
+
+    try
+    {
+        write_all(fd, buffer.data(), buffer.size());
+    }
+    catch (std::system_error& e)
+    {
+        Log::error() << "failed to write correlation file " << filename << ": " << e.what();
+    }
+    ::close(fd);
+}
+
+template <typename Real>
+char* copy_values(char* pos, const Real* values, std::size_t size)
+{
+    if constexpr (std::is_same_v<Real, double>)
+    {
+        std::memcpy(pos, values, size * sizeof(double));
+    }
+    else
+    {
+        auto* out = reinterpret_cast<double*>(pos);
+        std::copy(values, values + size, out);
+    }
+    return pos + size * sizeof(double);
+}
+
+template <typename Real>
+void write_dump(const std::string& filename, CorrelationDumpHeader header, const std::string& tag,
+                const Real* left, const Real* right, const Real* correlation)
+{
+    std::copy(std::begin(CorrelationDumpHeader::magic_value),
+              std::end(CorrelationDumpHeader::magic_value), header.magic);
+    header.version = CorrelationDumpHeader::version_value;
+    header.header_size = sizeof(CorrelationDumpHeader);
+    std::fill(std::begin(header.tag), std::end(header.tag), '\0');
+    tag.copy(header.tag, sizeof(header.tag) - 1);
+
+    auto input_bytes = header.input_size * sizeof(double);
+    auto correlation_bytes = header.correlation_size * sizeof(double);
+    std::vector<char> buffer(sizeof(header) + 2 * input_bytes + correlation_bytes);
+    auto* pos = buffer.data();
+    std::memcpy(pos, &header, sizeof(header));
+    pos += sizeof(header);
+    pos = copy_values(pos, left, header.input_size);
+    pos = copy_values(pos, right, header.input_size);
+    copy_values(pos, correlation, header.correlation_size);
+
+    pending_dumps().add(std::async(std::launch::async,
+                                   [filename, buffer = std::move(buffer)]()
+                                   { write_file(filename, buffer); }));
+}
+} // namespace
+
+void write_correlation_dump(const std::string& filename, CorrelationDumpHeader header,
+                            const std::string& tag, const double* left, const double* right,
+                            const double* correlation)
+{
+    write_dump(filename, header, tag, left, right, correlation);
+}
+
+void write_correlation_dump(const std::string& filename, CorrelationDumpHeader header,
+                            const std::string& tag, const float* left, const float* right,
+                            const float* correlation)
+{
+    write_dump(filename, header, tag, left, right, correlation);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+// Binary dump of a correlation for debugging the time synchronization. The file starts with this
+// header, followed by the resampled left (footprint) and right (measured) input signals of
+// input_size values each and the correlation_size correlation values, all as native doubles.
+// The header size is a multiple of 8, so the whole file can be mapped as-is, e.g. with
+// numpy.memmap.
+struct CorrelationDumpHeader
+{
+    static constexpr char magic_value[8] = { 'M', 'Q', 'C', 'O', 'R', 'R', '\0', '\0' };
+    static constexpr std::uint32_t version_value = 2;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t header_size;
+    char tag[256]; // zero-terminated, truncated if necessary, e.g. <metric>-begin
+    std::int64_t interval_ns;
+    std::int64_t oversampling;
+    std::uint64_t input_size;
+    std::uint64_t correlation_size;
+    std::uint64_t mainlobe_index;
+    std::uint64_t sidelobe_index;
+    double mainlobe;
+    double sidelobe;
+};
+
+static_assert(sizeof(CorrelationDumpHeader) % sizeof(double) == 0,
+              "The data after the header must be aligned");
+static_assert(sizeof(CorrelationDumpHeader) == 336, "The header size is documented in the README");
+
+// Copies the header and the signals into a single buffer, which is written with one write on a
+// background thread. Pending dumps are completed before the process exits. Single precision
+// signals are converted, so the format is the same for both.
+void write_correlation_dump(const std::string& filename, CorrelationDumpHeader header,
+                            const std::string& tag, const double* left, const double* right,
+                            const double* correlation);
+void write_correlation_dump(const std::string& filename, CorrelationDumpHeader header,
+                            const std::string& tag, const float* left, const float* right,
+                            const float* correlation);
@@ -0,0 +1,178 @@
+#include "fft.hpp"
+
+#include <scorep/plugin/util/environment.hpp>
+
+#include <stdexcept>
+#include <string>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sched.h>
+
+// FFTW for each precision may or may not have been built with threads
+template <typename Real>
+constexpr bool has_threads = false;
+#ifdef ENABLE_FFTW_THREADS
+template <>
+constexpr bool has_threads<double> = true;
+#endif
+#ifdef ENABLE_FFTW_FLOAT_THREADS
+template <>
+constexpr bool has_threads<float> = true;
+#endif
+
+// Number of threads for the transforms, by default all CPUs this process may run on
+[[maybe_unused]] static int fft_threads()
+{
+    if (auto threads_str = scorep::environment_variable::get("SYNC_FFT_THREADS");
+        !threads_str.empty())
+    {
+        try
+        {
+            auto threads = std::stoi(threads_str);
+            if (threads < 0)
+            {
+                throw std::out_of_range("");
+            }
+            if (threads > 0)
+            {
+                return threads;
+            }
+        }
+        catch (std::logic_error&)
+        {
+            Log::error() << "Invalid number of threads specified in "
+                         << scorep::environment_variable::name("SYNC_FFT_THREADS")
+                         << ", using all CPUs of the process.";
+        }
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &cpu_set))
+    {
+        Log::warn() << "failed to get process affinity: " << strerror(errno)
+                    << ", using a single FFT thread.";
+        return 1;
+    }
+    return CPU_COUNT(&cpu_set);
+}
+
+template <typename Real>
+FFTPlanner<Real>& FFTPlanner<Real>::instance()
+{
+    static FFTPlanner planner;
+    return planner;
+}
+
+template <typename Real>
+FFTPlanner<Real>::FFTPlanner()
+{
+    auto planner = scorep::environment_variable::get("SYNC_FFT_PLANNER", "estimate");
+    if (planner == "estimate")
+    {
+        flags_ = FFTW_ESTIMATE;
+    }
+    else if (planner == "measure")
+    {
+        flags_ = FFTW_MEASURE;
+    }
+    else if (planner == "patient")
+    {
+        flags_ = FFTW_PATIENT;
+    }
+    else if (planner == "exhaustive")
+    {
+        flags_ = FFTW_EXHAUSTIVE;
+    }
+    else
+    {
+        Log::error() << "Invalid planner specified in "
+                     << scorep::environment_variable::name("SYNC_FFT_PLANNER")
+                     << ", using estimate.";
+    }
+
+    if constexpr (has_threads<Real>)
+    {
+        if (FFTW<Real>::init_threads())
+        {
+            threads_ = fft_threads();
+            Log::debug() << "using " << threads_ << " threads for FFTs";
+            FFTW<Real>::plan_with_nthreads(threads_);
+        }
+        else
+        {
+            Log::warn() << "failed to initialize FFTW threads, using a single thread.";
+        }
+    }
+
+    wisdom_file_ = scorep::environment_variable::get("SYNC_FFT_WISDOM");
+    if (!wisdom_file_.empty())
+    {
+        wisdom_file_ += FFTW<Real>::wisdom_suffix;
+        if (FFTW<Real>::import_wisdom(wisdom_file_.c_str()))
+        {
+            Log::debug() << "loaded FFTW wisdom from " << wisdom_file_;
+        }
+        else
+        {
+            Log::info() << "no FFTW wisdom loaded from " << wisdom_file_;
+        }
+    }
+}
+
+template <typename Real>
+FFTPlanner<Real>::~FFTPlanner()
+{
+    for (auto& elem : plans_)
+    {
+        FFTW<Real>::destroy_plan(elem.second);
+    }
+}
+
+template <typename Real>
+typename FFTPlanner<Real>::plan FFTPlanner<Real>::r2c(std::size_t size, Real* in, complex* out)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& plan = plans_[{ size, true }];
+    if (plan == nullptr)
+    {
+        Log::debug() << "planning forward FFT of size " << size;
+        plan = FFTW<Real>::plan_r2c(size, in, out, flags_);
+        store_wisdom();
+    }
+    return plan;
+}
+
+template <typename Real>
+typename FFTPlanner<Real>::plan FFTPlanner<Real>::c2r(std::size_t size, complex* in, Real* out)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& plan = plans_[{ size, false }];
+    if (plan == nullptr)
+    {
+        Log::debug() << "planning inverse FFT of size " << size;
+        plan = FFTW<Real>::plan_c2r(size, in, out, flags_);
+        store_wisdom();
+    }
+    return plan;
+}
+
+template <typename Real>
+void FFTPlanner<Real>::store_wisdom()
+{
+    if (wisdom_file_.empty())
+    {
+        return;
+    }
+    if (!FFTW<Real>::export_wisdom(wisdom_file_.c_str()))
+    {
+        Log::warn() << "failed to store FFTW wisdom in " << wisdom_file_;
+    }
+}
+
+template class FFTPlanner<double>;
+#ifdef ENABLE_FFTW_FLOAT
+template class FFTPlanner<float>;
+#endif
@@ -7,6 +7,10 @@
 #include <algorithm>
 #include <complex>
 #include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <cassert>
@@ -19,21 +23,146 @@ using complex_type = std::complex<double>;
 
 static_assert(sizeof(complex_type) == sizeof(fftw_complex), "You're fucked.");
 
-inline void check_finite(complex_type z)
+// Maps the precision to the corresponding FFTW API, single precision requires fftw3f
+template <typename Real>
+struct FFTW;
+
+template <>
+struct FFTW<double>
 {
-    if (!(std::isfinite(z.real()) && std::isfinite(z.imag())))
+    using complex = fftw_complex;
+    using plan = fftw_plan;
+
+    static constexpr const char* wisdom_suffix = "";
+
+    static void* malloc(std::size_t size)
     {
-        throw std::runtime_error("Infinite complex value");
+        return fftw_malloc(size);
     }
-}
 
-inline void check_finite(double a)
+    static void free(void* p)
+    {
+        fftw_free(p);
+    }
+
+    static plan plan_r2c(std::size_t size, double* in, complex* out, unsigned flags)
+    {
+        return fftw_plan_dft_r2c_1d(size, in, out, flags);
+    }
+
+    static plan plan_c2r(std::size_t size, complex* in, double* out, unsigned flags)
+    {
+        return fftw_plan_dft_c2r_1d(size, in, out, flags);
+    }
+
+    static void execute_r2c(plan p, double* in, complex* out)
+    {
+        fftw_execute_dft_r2c(p, in, out);
+    }
+
+    static void execute_c2r(plan p, complex* in, double* out)
+    {
+        fftw_execute_dft_c2r(p, in, out);
+    }
+
+    static void destroy_plan(plan p)
+    {
+        fftw_destroy_plan(p);
+    }
+
+    static bool import_wisdom(const char* filename)
+    {
+        return fftw_import_wisdom_from_filename(filename);
+    }
+
+    static bool export_wisdom(const char* filename)
+    {
+        return fftw_export_wisdom_to_filename(filename);
+    }
+
+#ifdef ENABLE_FFTW_THREADS
+    static bool init_threads()
+    {
+        return fftw_init_threads();
+    }
+
+    static void plan_with_nthreads(int threads)
+    {
+        fftw_plan_with_nthreads(threads);
+    }
+#endif
+};
+
+#ifdef ENABLE_FFTW_FLOAT
+static_assert(sizeof(std::complex<float>) == sizeof(fftwf_complex), "You're fucked.");
+
+template <>
+struct FFTW<float>
 {
-    if (!std::isfinite(a))
+    using complex = fftwf_complex;
+    using plan = fftwf_plan;
+
+    // single and double precision wisdom can't be stored in the same file
+    static constexpr const char* wisdom_suffix = ".float";
+
+    static void* malloc(std::size_t size)
     {
-        throw std::runtime_error("Infinite value");
+        return fftwf_malloc(size);
     }
-}
+
+    static void free(void* p)
+    {
+        fftwf_free(p);
+    }
+
+    static plan plan_r2c(std::size_t size, float* in, complex* out, unsigned flags)
+    {
+        return fftwf_plan_dft_r2c_1d(size, in, out, flags);
+    }
+
+    static plan plan_c2r(std::size_t size, complex* in, float* out, unsigned flags)
+    {
+        return fftwf_plan_dft_c2r_1d(size, in, out, flags);
+    }
+
+    static void execute_r2c(plan p, float* in, complex* out)
+    {
+        fftwf_execute_dft_r2c(p, in, out);
+    }
+
+    static void execute_c2r(plan p, complex* in, float* out)
+    {
+        fftwf_execute_dft_c2r(p, in, out);
+    }
+
+    static void destroy_plan(plan p)
+    {
+        fftwf_destroy_plan(p);
+    }
+
+    static bool import_wisdom(const char* filename)
+    {
+        return fftwf_import_wisdom_from_filename(filename);
+    }
+
+    static bool export_wisdom(const char* filename)
+    {
+        return fftwf_export_wisdom_to_filename(filename);
+    }
+
+#ifdef ENABLE_FFTW_FLOAT_THREADS
+    static bool init_threads()
+    {
+        return fftwf_init_threads();
+    }
+
+    static void plan_with_nthreads(int threads)
+    {
+        fftwf_plan_with_nthreads(threads);
+    }
+#endif
+};
+#endif
 
 template <typename T>
 struct SizeHelper
@@ -45,8 +174,8 @@ struct SizeHelper
 };
 
 // The complex vectors in the FFTW have less elements
-template <>
-struct SizeHelper<complex_type>
+template <typename Real>
+struct SizeHelper<std::complex<Real>>
 {
     static std::size_t size(std::size_t s)
     {
@@ -60,33 +189,78 @@ size_t type_size(size_t s)
     return SizeHelper<T>::size(s);
 }
 
-template <typename IN, typename OUT>
+// Creates FFTW plans once per size and direction and shares them between all FFT/IFFT objects
+// of the same precision. The planner rigor is set by SYNC_FFT_PLANNER. If SYNC_FFT_WISDOM names a
+// file, wisdom is loaded from it on first use and stored to it after each new plan, so later runs
+// plan instantly. Single precision wisdom is stored in the same file name suffixed with .float.
+template <typename Real>
+class FFTPlanner
+{
+public:
+    using complex = typename FFTW<Real>::complex;
+    using plan = typename FFTW<Real>::plan;
+
+    static FFTPlanner& instance();
+
+    plan r2c(std::size_t size, Real* in, complex* out);
+    plan c2r(std::size_t size, complex* in, Real* out);
+
+    // Number of threads each planned transform runs on
+    int threads() const
+    {
+        return threads_;
+    }
+
+    ~FFTPlanner();
+
+private:
+    FFTPlanner();
+
+    void store_wisdom();
+
+    std::mutex mutex_;
+    unsigned flags_ = FFTW_ESTIMATE;
+    int threads_ = 1;
+    std::string wisdom_file_;
+    std::map<std::pair<std::size_t, bool>, plan> plans_;
+};
+
+template <typename Real, typename IN, typename OUT>
 class FFTBase
 {
 public:
     FFTBase(std::size_t size)
-    : size_(size), in_((IN*)fftw_malloc(sizeof(IN) * in_size())),
-      out_((OUT*)fftw_malloc(sizeof(OUT) * out_size()))
+    : size_(size), in_((IN*)FFTW<Real>::malloc(sizeof(IN) * in_size())),
+      out_((OUT*)FFTW<Real>::malloc(sizeof(OUT) * out_size()))
     {
         assert(in_);
         assert(out_);
     }
 
-    ~FFTBase()
+    virtual ~FFTBase()
     {
-        fftw_free(in_);
-        fftw_free(out_);
-        fftw_destroy_plan(plan_);
+        FFTW<Real>::free(in_);
+        FFTW<Real>::free(out_);
     }
 
+    FFTBase(const FFTBase&) = delete;
+    FFTBase& operator=(const FFTBase&) = delete;
+
     template <typename IT>
     const void operator()(IT begin, IT end)
     {
         auto len = std::distance(begin, end);
         assert(len <= in_size());
         std::copy(begin, end, in_);
+        transform(len);
+    }
+
+    // Transforms the first len values that have been written into the input buffer
+    void transform(std::size_t len)
+    {
+        assert(len <= in_size());
         std::fill(in_ + len, in_ + in_size(), IN());
-        fftw_execute(plan_);
+        execute();
     }
 
     std::size_t in_size() const
@@ -119,48 +293,66 @@ public:
         return out_ + out_size();
     }
 
-    void check_finite()
-    {
-        for (auto it = in_begin(); it != in_end(); ++it)
-        {
-            ::check_finite(*it);
-        }
-        for (auto it = out_begin(); it != out_end(); ++it)
-        {
-            ::check_finite(*it);
-        }
-    }
-
 protected:
+    using complex = typename FFTW<Real>::complex;
+
+    // runs the shared plan on the buffers of this object
+    virtual void execute() = 0;
+
     std::size_t size_;
     IN* in_ = nullptr;
     OUT* out_ = nullptr;
-    fftw_plan plan_;
+    typename FFTW<Real>::plan plan_;
 };
 
-class FFT : public FFTBase<double, complex_type>
+template <typename Real = double>
+class FFT : public FFTBase<Real, Real, std::complex<Real>>
 {
+    using Base = FFTBase<Real, Real, std::complex<Real>>;
+    using typename Base::complex;
+    using Base::in_;
+    using Base::out_;
+    using Base::plan_;
+    using Base::size_;
+
 public:
-    FFT(std::size_t size) : FFTBase(size)
+    FFT(std::size_t size) : Base(size)
     {
         assert(in_);
         assert(out_);
-        plan_ =
-            fftw_plan_dft_r2c_1d(size_, in_, reinterpret_cast<fftw_complex*>(out_), FFTW_ESTIMATE);
+        plan_ = FFTPlanner<Real>::instance().r2c(size_, in_, reinterpret_cast<complex*>(out_));
         assert(plan_);
     }
+
+protected:
+    void execute() override
+    {
+        FFTW<Real>::execute_r2c(plan_, in_, reinterpret_cast<complex*>(out_));
+    }
 };
 
-class IFFT : public FFTBase<complex_type, double>
+template <typename Real = double>
+class IFFT : public FFTBase<Real, std::complex<Real>, Real>
 {
+    using Base = FFTBase<Real, std::complex<Real>, Real>;
+    using typename Base::complex;
+    using Base::in_;
+    using Base::out_;
+    using Base::plan_;
+    using Base::size_;
+
 public:
-    IFFT(std::size_t size) : FFTBase(size)
+    IFFT(std::size_t size) : Base(size)
     {
         assert(in_);
         assert(out_);
-        plan_ =
-            fftw_plan_dft_c2r_1d(size_, reinterpret_cast<fftw_complex*>(in_), out_, FFTW_ESTIMATE);
-
+        plan_ = FFTPlanner<Real>::instance().c2r(size_, reinterpret_cast<complex*>(in_), out_);
         assert(plan_);
     }
+
+protected:
+    void execute() override
+    {
+        FFTW<Real>::execute_c2r(plan_, reinterpret_cast<complex*>(in_), out_);
+    }
 };
@@ -1,8 +1,15 @@
 #include "footprint.hpp"
 #include "msequence.hpp"
 
-#include <scorep/plugin/util/environment.hpp>
+#include <metricq/ostream.hpp>
 
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
 #include <chrono>
 #include <vector>
 
@@ -10,16 +17,62 @@
 
 namespace timesync
 {
-void Footprint::high()
+Footprint::Footprint(int msequence_exponent, Duration quantum, Duration tolerance, int threads,
+                     FootprintKernel kernel, int granularity)
+: msequence_exponent_(msequence_exponent), quantum_(quantum), tolerance_(tolerance),
+  threads_(threads), kernel_(kernel), granularity_(granularity),
+  compute_vec_a_(compute_size, 1.0), compute_vec_b_(compute_size, 2.0)
 {
-    double m = 0.0;
-    for (std::size_t r = 0; r < compute_rep; r++)
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernel_ == FootprintKernel::fma && !__builtin_cpu_supports("avx512f"))
     {
-        for (size_t i = 0; i < compute_size; i++)
-        {
-            m += compute_vec_a_[i] * compute_vec_b_[i];
-        }
+        Log::warn() << "AVX-512 is not supported, using the scalar footprint kernel";
+        kernel_ = FootprintKernel::scalar;
+    }
+#elif !defined(__aarch64__)
+    if (kernel_ == FootprintKernel::fma)
+    {
+        Log::warn() << "There is no FMA kernel for this architecture, using the scalar footprint "
+                       "kernel";
+        kernel_ = FootprintKernel::scalar;
+    }
+#endif
+
+    // rough equivalents of the scalar kernel if there is no calibration
+    switch (kernel_)
+    {
+    case FootprintKernel::scalar:
+        break;
+    case FootprintKernel::fma:
+        high_rep_ = 4 * compute_rep;
+        break;
+    case FootprintKernel::stream:
+        stream_buffer_.assign(stream_size, 1.0);
+        high_rep_ = 12;
+        break;
+    }
+}
+
+void Footprint::high_kernel(std::size_t rep)
+{
+    switch (kernel_)
+    {
+    case FootprintKernel::scalar:
+        high_scalar(rep);
+        break;
+    case FootprintKernel::fma:
+        high_fma(rep);
+        break;
+    case FootprintKernel::stream:
+        high_stream(rep);
+        break;
     }
+}
+
+namespace
+{
+void keep(double m)
+{
     if (m == 42.0)
     {
 // prevent optimization, sure there is an easier way
@@ -30,10 +83,110 @@ void Footprint::high()
 #endif
     }
 }
+} // namespace
 
-void Footprint::low()
+void Footprint::high_scalar(std::size_t rep)
 {
-    for (uint64_t i = 0; i < nop_rep; i++)
+    double m = 0.0;
+    for (std::size_t r = 0; r < rep; r++)
+    {
+        for (size_t i = 0; i < compute_size; i++)
+        {
+            m += compute_vec_a_[i] * compute_vec_b_[i];
+        }
+    }
+    keep(m);
+}
+
+// Eight independent chains hide the FMA latency. The chains converge to 2, so there are neither
+// overflows nor denormals.
+#ifdef __aarch64__
+void Footprint::high_fma(std::size_t rep)
+{
+    float64x2_t acc[8];
+    for (auto& a : acc)
+    {
+        a = vdupq_n_f64(0.0);
+    }
+    const auto factor = vdupq_n_f64(0.5);
+    const auto addend = vdupq_n_f64(1.0);
+    for (std::size_t r = 0; r < rep; r++)
+    {
+        for (std::size_t i = 0; i < fma_size; i++)
+        {
+            for (auto& a : acc)
+            {
+                a = vfmaq_f64(addend, a, factor);
+            }
+        }
+    }
+    double m = 0.0;
+    for (auto& a : acc)
+    {
+        m += vaddvq_f64(a);
+    }
+    keep(m);
+}
+#elif defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx512f"))) void Footprint::high_fma(std::size_t rep)
+{
+    __m512d acc[8];
+    for (auto& a : acc)
+    {
+        a = _mm512_setzero_pd();
+    }
+    const auto factor = _mm512_set1_pd(0.5);
+    const auto addend = _mm512_set1_pd(1.0);
+    for (std::size_t r = 0; r < rep; r++)
+    {
+        for (std::size_t i = 0; i < fma_size; i++)
+        {
+            for (auto& a : acc)
+            {
+                a = _mm512_fmadd_pd(a, factor, addend);
+            }
+        }
+    }
+    double m = 0.0;
+    for (auto& a : acc)
+    {
+        m += _mm512_reduce_add_pd(a);
+    }
+    keep(m);
+}
+#else
+void Footprint::high_fma(std::size_t rep)
+{
+    high_scalar(rep);
+}
+#endif
+
+void Footprint::high_stream(std::size_t rep)
+{
+    // each thread walks through the shared buffer on its own
+    thread_local std::size_t position = 0;
+    const auto* buffer = stream_buffer_.data();
+    double m = 0.0;
+    for (std::size_t r = 0; r < rep; r++)
+    {
+        if (position + stream_block > stream_buffer_.size())
+        {
+            position = 0;
+        }
+        const auto* block = buffer + position;
+#pragma omp simd reduction(+ : m)
+        for (std::size_t i = 0; i < stream_block; i++)
+        {
+            m += block[i];
+        }
+        position += stream_block;
+    }
+    keep(m);
+}
+
+void Footprint::low_kernel(std::size_t rep)
+{
+    for (uint64_t i = 0; i < rep; i++)
     {
 #ifdef __aarch64__
         asm volatile("yield" ::: "memory");
@@ -43,8 +196,58 @@ void Footprint::low()
     }
 }
 
+namespace
+{
+// Repetitions of the kernel for a call of the target duration. The measurement runs long enough
+// for the frequency of the CPU to settle.
+template <typename Kernel>
+std::size_t calibrate_kernel(Kernel kernel, Duration target)
+{
+    constexpr std::size_t max_rep = std::size_t(1) << 40;
+    const Duration measurement = std::chrono::milliseconds(20);
+
+    std::size_t rep = 1;
+    Duration elapsed;
+    do
+    {
+        rep *= 2;
+        auto begin = Clock::now();
+        kernel(rep);
+        elapsed = Clock::now() - begin;
+    } while (elapsed < target && rep < max_rep);
+
+    std::size_t calls = 0;
+    auto begin = Clock::now();
+    do
+    {
+        kernel(rep);
+        calls++;
+        elapsed = Clock::now() - begin;
+    } while (elapsed < measurement);
+
+    auto call = std::chrono::duration<double>(elapsed) / calls;
+    auto calibrated = static_cast<double>(rep) * (std::chrono::duration<double>(target) / call);
+    return std::max<std::size_t>(1, static_cast<std::size_t>(calibrated));
+}
+} // namespace
+
+void Footprint::calibrate()
+{
+    if (granularity_ <= 0)
+    {
+        return;
+    }
+
+    auto target = quantum_ / granularity_;
+    high_rep_ = calibrate_kernel([this](std::size_t rep) { high_kernel(rep); }, target);
+    low_rep_ = calibrate_kernel([this](std::size_t rep) { low_kernel(rep); }, target);
+    Log::debug() << "calibrated footprint kernels to " << high_rep_ << " (high) and " << low_rep_
+                 << " (low) repetitions for " << target;
+}
+
 void Footprint::check_affinity()
 {
+    restore_affinity_ = false;
     CPU_ZERO(&cpu_set_old_);
     auto err = sched_getaffinity(0, sizeof(cpu_set_t), &cpu_set_old_);
     if (err)
@@ -53,9 +256,21 @@ void Footprint::check_affinity()
         return;
     }
 
+    // the pattern runs on the first CPU the process may use
+    pattern_cpu_ = 0;
+    while (pattern_cpu_ < CPU_SETSIZE && !CPU_ISSET(pattern_cpu_, &cpu_set_old_))
+    {
+        pattern_cpu_++;
+    }
+    if (pattern_cpu_ == CPU_SETSIZE)
+    {
+        Log::error() << "failed to set thread affinity: empty affinity mask";
+        return;
+    }
+
     cpu_set_t cpu_set_target;
     CPU_ZERO(&cpu_set_target);
-    CPU_SET(0, &cpu_set_target);
+    CPU_SET(pattern_cpu_, &cpu_set_target);
     err = sched_setaffinity(0, sizeof(cpu_set_t), &cpu_set_target);
     if (err)
     {
@@ -77,28 +292,103 @@ void Footprint::restore_affinity()
     }
 }
 
-void Footprint::run(int msequence_exponent, Duration quantum)
+void Footprint::start_workers()
 {
-    check_affinity();
+    if (threads_ == 1 || !restore_affinity_)
+    {
+        return;
+    }
 
-    recording_.resize(0);
-    recording_.reserve(4096);
+    // the pattern itself runs on pattern_cpu_
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (threads_ > 0 && static_cast<int>(cpus.size()) + 1 >= threads_)
+        {
+            break;
+        }
+        if (cpu != pattern_cpu_ && CPU_ISSET(cpu, &cpu_set_old_))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    Log::debug() << "running synchronization pattern on " << cpus.size() + 1 << " CPUs";
 
-    Duration tolerance = std::chrono::seconds(2);
-    if (auto tolerance_str = scorep::environment_variable::get("SYNC_TOLERANCE");
-        !tolerance_str.empty())
+    level_.store(0, std::memory_order_relaxed);
+    for (auto cpu : cpus)
     {
-        tolerance = metricq::duration_parse(tolerance_str);
+        workers_.emplace_back([this, cpu]() { work(cpu); });
     }
+}
 
-    auto sequence = GroupedBinaryMSequence(msequence_exponent);
+void Footprint::stop_workers()
+{
+    level_.store(stop_level, std::memory_order_relaxed);
+    for (auto& worker : workers_)
+    {
+        worker.join();
+    }
+    workers_.clear();
+}
 
-    time_begin_ = low(tolerance);
+void Footprint::work(int cpu)
+{
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &cpu_set))
+    {
+        Log::warn() << "failed to set thread affinity to CPU " << cpu << ": " << strerror(errno);
+    }
+
+    for (int level; (level = level_.load(std::memory_order_relaxed)) != stop_level;)
+    {
+        if (level)
+        {
+            high();
+        }
+        else
+        {
+            low();
+        }
+    }
+}
+
+void Footprint::run(int msequence_exponent, Duration quantum, const std::function<bool()>& stop)
+{
+    check_affinity();
+
+    // joinable workers must not be destroyed if the pattern throws
+    struct Cleanup
+    {
+        Footprint& footprint;
+
+        ~Cleanup()
+        {
+            footprint.stop_workers();
+            footprint.restore_affinity();
+        }
+    } cleanup{ *this };
+
+    const auto sequence = grouped_msequence(msequence_exponent);
+
+    recording_.resize(0);
+    recorded_.store(0, std::memory_order_release);
+    // one entry per run of the sequence, plus the padding
+    recording_.reserve(sequence.size() + 2);
+
+    calibrate();
+    start_workers();
+    time_begin_ = low(tolerance_);
     time_end_ = time_begin_;
     auto deadline = time_begin_;
-    while (auto elem = sequence.take())
+    for (const auto& [is_high, length] : sequence)
     {
-        auto [is_high, length] = *elem;
+        if (stop && stop())
+        {
+            Log::info() << "stopping synchronization pattern early";
+            break;
+        }
         auto duration = quantum * length;
         deadline += duration;
         if (deadline <= time_end_)
@@ -116,9 +406,7 @@ void Footprint::run(int msequence_exponent, Duration quantum)
         }
     }
 
-    low(tolerance);
-
-    restore_affinity();
+    low(tolerance_);
 }
 
 } // namespace timesync
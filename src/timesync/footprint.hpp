@@ -7,7 +7,10 @@
 
 #include <sched.h>
 
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <thread>
 #include <vector>
 
 #include <cassert>
@@ -22,14 +25,30 @@ using Log = metricq::logger::nitro::Log;
 
 uint64_t sqrtsd_loop_(double* buffer, uint64_t elems, uint64_t repeat);
 
+enum class FootprintKernel
+{
+    scalar, // dot product of two small vectors
+    fma,    // independent FMA chains, AVX-512 on x86_64, NEON on aarch64
+    stream  // reads through a buffer larger than the caches
+};
+
 class Footprint
 {
 public:
-    Footprint(int msequence_exponent, Duration quantum)
-    : compute_vec_a_(compute_size, 1.0), compute_vec_b_(compute_size, 2.0)
+    // With threads > 1, the pattern is played synchronously on that many CPUs of the process
+    // affinity mask for a larger power amplitude, 0 means all of them.
+    // With granularity > 0, the kernels are calibrated before the pattern so that a single call
+    // takes quantum / granularity, which bounds the error at each edge of the pattern. Otherwise
+    // fixed repetition counts are used.
+    Footprint(int msequence_exponent, Duration quantum, Duration tolerance, int threads = 1,
+              FootprintKernel kernel = FootprintKernel::scalar, int granularity = 0);
+
+    // Plays the pattern with tolerance padding on both sides. If stop returns true between two
+    // elements of the sequence, the rest of it is skipped.
+    void run(const std::function<bool()>& stop = {})
     {
         Log::info() << "staring synchronization pattern";
-        run(msequence_exponent, quantum);
+        run(msequence_exponent_, quantum_, stop);
         Log::info() << "completed synchronization pattern";
     }
 
@@ -48,17 +67,46 @@ public:
         return time_end_;
     }
 
+    // padding before and after the sequence
+    Duration tolerance() const
+    {
+        return tolerance_;
+    }
+
     const std::vector<TimeValue>& recording() const
     {
         return recording_;
     };
 
+    // Copy of the recording so far, can be called from another thread while the pattern runs
+    std::vector<TimeValue> recording_snapshot() const
+    {
+        auto size = recorded_.load(std::memory_order_acquire);
+        return std::vector<TimeValue>(recording_.data(), recording_.data() + size);
+    }
+
 protected:
-    void low();
-    void high();
+    void low()
+    {
+        low_kernel(low_rep_);
+    }
+
+    void high()
+    {
+        high_kernel(high_rep_);
+    }
+
+    void low_kernel(std::size_t rep);
+    void high_kernel(std::size_t rep);
+    void high_scalar(std::size_t rep);
+    void high_fma(std::size_t rep);
+    void high_stream(std::size_t rep);
+
+    void calibrate();
 
     auto low(Duration duration)
     {
+        level_.store(0, std::memory_order_relaxed);
         auto time = Clock::now();
         auto end = time + duration;
         do
@@ -66,12 +114,13 @@ protected:
             low();
             time = Clock::now();
         } while (time < end);
-        recording_.emplace_back(time, -1.0);
+        record(time, -1.0);
         return time;
     }
 
     auto high(Duration duration)
     {
+        level_.store(1, std::memory_order_relaxed);
         auto time = Clock::now();
         auto end = time + duration;
         do
@@ -79,7 +128,7 @@ protected:
             high();
             time = Clock::now();
         } while (time < end);
-        recording_.emplace_back(time, 1.0);
+        record(time, 1.0);
         return time;
     }
 
@@ -95,23 +144,54 @@ protected:
         }
     }
 
-    void run(int msequence_exponent, Duration quantum);
+    void run(int msequence_exponent, Duration quantum, const std::function<bool()>& stop);
+
+    void record(Clock::time_point time, double value)
+    {
+        // capacity is reserved before the pattern, so readers of a snapshot see no reallocation
+        assert(recording_.size() < recording_.capacity());
+        recording_.emplace_back(time, value);
+        recorded_.store(recording_.size(), std::memory_order_release);
+    }
 
     void check_affinity();
     void restore_affinity();
 
+    // Workers follow the level set by the thread running the pattern until it is set to stop
+    void start_workers();
+    void stop_workers();
+    void work(int cpu);
+
 private:
     static constexpr std::size_t compute_size = 256;
     static constexpr std::size_t compute_rep = 58;
     static constexpr std::size_t nop_rep = 209;
+    static constexpr std::size_t fma_size = 64;
+    static constexpr std::size_t stream_block = 2048;
+    static constexpr std::size_t stream_size = 4 * 1024 * 1024;
+    int msequence_exponent_;
+    Duration quantum_;
+    Duration tolerance_;
+    int threads_;
+    FootprintKernel kernel_;
+    int granularity_;
+    std::size_t high_rep_ = compute_rep;
+    std::size_t low_rep_ = nop_rep;
     Clock::time_point time_begin_;
     Clock::time_point time_end_;
 
     std::vector<double> compute_vec_a_;
     std::vector<double> compute_vec_b_;
+    std::vector<double> stream_buffer_;
     std::vector<TimeValue> recording_;
+    std::atomic<std::size_t> recorded_{ 0 };
+
+    static constexpr int stop_level = -1;
+    std::atomic<int> level_{ 0 };
+    std::vector<std::thread> workers_;
 
     bool restore_affinity_ = false;
     cpu_set_t cpu_set_old_;
+    int pattern_cpu_ = 0;
 };
 } // namespace timesync
@@ -0,0 +1,220 @@
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <cassert>
+#include <cmath>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MULTIVERSIONED __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define MULTIVERSIONED
+#endif
+
+// The implementations are shared by both precisions and inlined into the multiversioned entry
+// points, so each one is compiled for all targets.
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// x - x is 0 for finite values and NaN otherwise, so sums of it are vectorizable finite checks
+
+namespace
+{
+template <typename Real>
+ALWAYS_INLINE bool cross_spectrum_impl(const std::complex<Real>* left,
+                                       const std::complex<Real>* right, std::complex<Real>* out,
+                                       std::size_t size)
+{
+    const auto* l = reinterpret_cast<const Real*>(left);
+    const auto* r = reinterpret_cast<const Real*>(right);
+    auto* o = reinterpret_cast<Real*>(out);
+    Real check = 0.;
+#pragma omp simd reduction(+ : check)
+    for (std::size_t i = 0; i < size; i++)
+    {
+        auto re = l[2 * i] * r[2 * i] + l[2 * i + 1] * r[2 * i + 1];
+        auto im = l[2 * i + 1] * r[2 * i] - l[2 * i] * r[2 * i + 1];
+        o[2 * i] = re;
+        o[2 * i + 1] = im;
+        check += (re - re) + (im - im);
+    }
+    return check == 0.;
+}
+} // namespace
+
+MULTIVERSIONED
+bool cross_spectrum(const std::complex<double>* left, const std::complex<double>* right,
+                    std::complex<double>* out, std::size_t size)
+{
+    return cross_spectrum_impl(left, right, out, size);
+}
+
+MULTIVERSIONED
+bool cross_spectrum(const std::complex<float>* left, const std::complex<float>* right,
+                    std::complex<float>* out, std::size_t size)
+{
+    return cross_spectrum_impl(left, right, out, size);
+}
+
+MULTIVERSIONED
+void correlate_edges(const double* prefix, const std::size_t* edges, const double* weights,
+                     std::size_t edge_count, double* out, std::size_t lags)
+{
+    // tiles of the output stay in the L1 cache while all edges are added to them
+    constexpr std::size_t tile = 2048;
+    for (std::size_t begin = 0; begin < lags; begin += tile)
+    {
+        const auto size = std::min(tile, lags - begin);
+        auto* o = out + begin;
+        std::fill(o, o + size, 0.);
+        for (std::size_t e = 0; e < edge_count; e++)
+        {
+            const auto* p = prefix + edges[e] + begin;
+            const auto w = weights[e];
+#pragma omp simd
+            for (std::size_t s = 0; s < size; s++)
+            {
+                o[s] += w * p[s];
+            }
+        }
+    }
+}
+
+namespace
+{
+struct BlockMax
+{
+    double max;
+    double abs_max;
+    double check;
+};
+
+template <typename Real>
+ALWAYS_INLINE BlockMax block_max_impl(const Real* values, std::size_t size)
+{
+    Real max = std::numeric_limits<Real>::lowest();
+    Real abs_max = 0.;
+    Real check = 0.;
+#pragma omp simd reduction(max : max) reduction(max : abs_max) reduction(+ : check)
+    for (std::size_t i = 0; i < size; i++)
+    {
+        auto value = values[i];
+        auto abs = std::fabs(value);
+        max = value > max ? value : max;
+        abs_max = abs > abs_max ? abs : abs_max;
+        check += value - value;
+    }
+    return { max, abs_max, check };
+}
+
+MULTIVERSIONED
+BlockMax block_max(const double* values, std::size_t size)
+{
+    return block_max_impl(values, size);
+}
+
+MULTIVERSIONED
+BlockMax block_max(const float* values, std::size_t size)
+{
+    return block_max_impl(values, size);
+}
+
+std::size_t distance(std::size_t a, std::size_t b, std::size_t size, bool circular)
+{
+    auto d = a > b ? a - b : b - a;
+    return circular ? std::min(d, size - d) : d;
+}
+
+template <typename Real>
+Lobes find_lobes_impl(const Real* values, std::size_t size, std::size_t exclusion, bool circular)
+{
+    assert(size > 0);
+    // the per-block magnitude maxima allow to find the sidelobe without a second full pass
+    constexpr std::size_t block = 1024;
+    const auto blocks = (size + block - 1) / block;
+    std::vector<double> block_abs_max(blocks);
+
+    Lobes result{ 0, std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(),
+                  0, true };
+    std::size_t main_block = 0;
+    double check = 0.;
+    for (std::size_t b = 0; b < blocks; b++)
+    {
+        auto begin = b * block;
+        auto max = block_max(values + begin, std::min(block, size - begin));
+        block_abs_max[b] = max.abs_max;
+        check += max.check;
+        if (max.max > result.mainlobe)
+        {
+            result.mainlobe = max.max;
+            main_block = b;
+        }
+    }
+    result.finite = check == 0.;
+    if (!result.finite)
+    {
+        return result;
+    }
+
+    auto begin = values + main_block * block;
+    auto end = values + std::min(size, (main_block + 1) * block);
+    result.mainlobe_index = std::find(begin, end, result.mainlobe) - values;
+
+    // the index within a block whose maximum is taken as a whole is only searched at the end
+    std::size_t side_block = blocks;
+    for (std::size_t b = 0; b < blocks; b++)
+    {
+        auto lo = b * block;
+        auto hi = std::min(size, lo + block);
+        if (block_abs_max[b] <= result.sidelobe)
+        {
+            continue;
+        }
+        // the closest element to the mainlobe is one of the ends of a block that doesn't contain it
+        auto contains = lo <= result.mainlobe_index && result.mainlobe_index < hi;
+        if (!contains &&
+            std::min(distance(lo, result.mainlobe_index, size, circular),
+                     distance(hi - 1, result.mainlobe_index, size, circular)) >= exclusion)
+        {
+            result.sidelobe = block_abs_max[b];
+            side_block = b;
+            continue;
+        }
+        for (auto i = lo; i < hi; i++)
+        {
+            if (distance(i, result.mainlobe_index, size, circular) >= exclusion &&
+                std::fabs(values[i]) > result.sidelobe)
+            {
+                result.sidelobe = std::fabs(values[i]);
+                result.sidelobe_index = i;
+                side_block = blocks;
+            }
+        }
+    }
+    if (side_block < blocks)
+    {
+        auto lo = side_block * block;
+        auto hi = std::min(size, lo + block);
+        for (auto i = lo; i < hi; i++)
+        {
+            if (std::fabs(values[i]) == result.sidelobe)
+            {
+                result.sidelobe_index = i;
+                break;
+            }
+        }
+    }
+    return result;
+}
+} // namespace
+
+Lobes find_lobes(const double* values, std::size_t size, std::size_t exclusion, bool circular)
+{
+    return find_lobes_impl(values, size, exclusion, circular);
+}
+
+Lobes find_lobes(const float* values, std::size_t size, std::size_t exclusion, bool circular)
+{
+    return find_lobes_impl(values, size, exclusion, circular);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <complex>
+
+#include <cstddef>
+
+// Hot loops of the correlation. They are compiled for AVX-512, AVX2 and a generic target on x86_64,
+// the fitting version is chosen at runtime.
+
+// out[i] = left[i] * conj(right[i]), returns false if any result is not finite
+bool cross_spectrum(const std::complex<double>* left, const std::complex<double>* right,
+                    std::complex<double>* out, std::size_t size);
+bool cross_spectrum(const std::complex<float>* left, const std::complex<float>* right,
+                    std::complex<float>* out, std::size_t size);
+
+struct Lobes
+{
+    std::size_t mainlobe_index;
+    double mainlobe;
+    double sidelobe; // largest magnitude at a distance >= exclusion from the mainlobe
+    std::size_t sidelobe_index;
+    bool finite;
+};
+
+// out[s] = sum_e weights[e] * prefix[edges[e] + s] for s < lags, the correlation of a piecewise
+// constant signal via the prefix sums of the other one. prefix must have edges[e] + lags values.
+void correlate_edges(const double* prefix, const std::size_t* edges, const double* weights,
+                     std::size_t edge_count, double* out, std::size_t lags);
+
+// Finds the maximum and the largest magnitude outside of its vicinity in a single pass. The
+// distance wraps around for circular correlations, but not for windows of lags.
+Lobes find_lobes(const double* values, std::size_t size, std::size_t exclusion,
+                 bool circular = true);
+Lobes find_lobes(const float* values, std::size_t size, std::size_t exclusion,
+                 bool circular = true);
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <initializer_list>
 #include <iostream>
 #include <optional>
+#include <stdexcept>
 #include <type_traits>
 #include <vector>
 
@@ -13,63 +15,77 @@ public:
     using ValueType = int;
 
 private:
-    static ValueType compute_coeffs(const std::vector<int>& coefficient_indices)
+    static constexpr ValueType taps(std::initializer_list<int> coefficient_indices)
     {
-        assert(coefficient_indices.size() > 0);
         int n = *coefficient_indices.begin();
         ValueType coeffs = 0;
         for (auto index : coefficient_indices)
         {
-            assert(n >= index);
             coeffs |= 1 << (n - index);
         }
         return coeffs;
     }
 
-    static std::vector<int> get_coefficient_indices(int n)
+    // feedback taps of maximum length shift registers
+    static constexpr ValueType coefficients(int n)
     {
         switch (n)
         {
         case 3:
-            return { 3, 1 };
+            return taps({ 3, 1 });
         case 4:
-            return { 4, 1 };
+            return taps({ 4, 1 });
         case 5:
-            return { 5, 2 };
+            return taps({ 5, 2 });
         case 6:
-            return { 6, 1 };
+            return taps({ 6, 1 });
         case 7:
-            return { 7, 1 };
+            return taps({ 7, 1 });
         case 8:
-            return { 8, 6, 5, 1 };
+            return taps({ 8, 6, 5, 1 });
         case 9:
-            return { 9, 4 };
+            return taps({ 9, 4 });
         case 10:
-            return { 10, 3 };
+            return taps({ 10, 3 });
         case 11:
-            return { 11, 2 };
+            return taps({ 11, 2 });
         case 12:
-            return { 12, 7, 4, 3 };
+            return taps({ 12, 7, 4, 3 });
         case 13:
-            return { 13, 4, 3, 1 };
+            return taps({ 13, 4, 3, 1 });
         case 14:
-            return { 14, 12, 11, 1 };
+            return taps({ 14, 12, 11, 1 });
+        case 15:
+            return taps({ 15, 14 });
+        case 16:
+            return taps({ 16, 15, 13, 4 });
+        case 17:
+            return taps({ 17, 14 });
+        case 18:
+            return taps({ 18, 11 });
+        case 19:
+            return taps({ 19, 6, 2, 1 });
+        case 20:
+            return taps({ 20, 17 });
+        case 21:
+            return taps({ 21, 19 });
+        case 22:
+            return taps({ 22, 21 });
+        case 23:
+            return taps({ 23, 18 });
+        case 24:
+            return taps({ 24, 23, 22, 17 });
         default:
             throw std::runtime_error("Unsupported sequence length");
         }
     }
 
-    BinaryMSequenceIter(int n, std::vector<int> coefficient_indices)
-    : BinaryMSequenceIter(n, compute_coeffs(coefficient_indices))
-    {
-    }
-
     BinaryMSequenceIter(int n, ValueType coeffs) : n_(n), coeffs_(coeffs)
     {
     }
 
 public:
-    BinaryMSequenceIter(int n) : BinaryMSequenceIter(n, get_coefficient_indices(n))
+    BinaryMSequenceIter(int n) : BinaryMSequenceIter(n, coefficients(n))
     {
     }
 
@@ -133,3 +149,23 @@ public:
 private:
     BinaryMSequenceIter underlying_iter_;
 };
+
+struct MSequenceRun
+{
+    bool level;
+    int length;
+};
+
+// The whole grouped sequence, so that no sequence logic remains between the deadlines of the
+// pattern. There are 2^(n-1) runs.
+inline std::vector<MSequenceRun> grouped_msequence(int n)
+{
+    std::vector<MSequenceRun> runs;
+    runs.reserve(std::size_t(1) << (n - 1));
+    GroupedBinaryMSequence sequence(n);
+    while (auto elem = sequence.take())
+    {
+        runs.push_back({ elem->first, elem->second });
+    }
+    return runs;
+}
@@ -12,8 +12,14 @@ static std::size_t next_power_of_2(std::size_t size)
     return size;
 }
 
-Shifter::Shifter(std::size_t size, const std::string& tag)
-: tag_(tag), size_(size), extended_size_(next_power_of_2(2 * size_ - 1)), fft_(extended_size_),
-  ifft_(extended_size_), tmp_(type_size<complex_type>(extended_size_))
+template <typename Real>
+Shifter<Real>::Shifter(std::size_t size, metricq::Duration interval, const std::string& tag)
+: tag_(tag), interval_(interval), size_(size), extended_size_(next_power_of_2(2 * size_ - 1)),
+  fft_left_(extended_size_), fft_right_(extended_size_), ifft_(extended_size_)
 {
 }
+
+template class Shifter<double>;
+#ifdef ENABLE_FFTW_FLOAT
+template class Shifter<float>;
+#endif
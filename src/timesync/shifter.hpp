@@ -1,103 +1,101 @@
+#include "correlation_dump.hpp"
 #include "fft.hpp"
+#include "kernels.hpp"
 
 #include <metricq/logger/nitro.hpp>
+#include <metricq/types.hpp>
 
 #include <scorep/plugin/plugin.hpp>
 
-#include <fstream>
-
 using Log = metricq::logger::nitro::Log;
 
+// Finds the shift between two signals by cross-correlation via FFT, computed in the given
+// floating point precision
+template <typename Real = double>
 class Shifter
 {
 
 public:
-    Shifter(std::size_t size, const std::string& tag);
+    // interval is the time between two samples of the signals, only used for the dump
+    Shifter(std::size_t size, metricq::Duration interval, const std::string& tag);
 
-    template <typename T1, typename T2>
-    int operator()(T1 left_begin, T1 left_end, T2 right_begin, T2 right_end,
-                   int oversampling_factor)
+    std::size_t size() const
     {
-        static int cnt = -1; // cheap hack for distinguishing begin/end synchronization
-        cnt++;
-
-        assert(std::distance(left_begin, left_end) == size_);
-        assert(std::distance(right_begin, right_end) == size_);
+        return size_;
+    }
 
-        fft_(left_begin, left_end);
-        fft_.check_finite();
-        assert(std::distance(fft_.out_begin(), fft_.out_end()) ==
-               type_size<complex_type>(extended_size_));
+    // main-sidelobe factor of the last correlation, below 3 it probably did not work
+    double quality() const
+    {
+        return quality_;
+    }
 
-        std::copy(fft_.out_begin(), fft_.out_end(), tmp_.begin());
+    // Producers can write size() values of each signal directly into these aligned buffers
+    Real* left_input()
+    {
+        return fft_left_.in_begin();
+    }
 
-        fft_(right_begin, right_end);
-        fft_.check_finite();
-        assert(std::distance(fft_.out_begin(), fft_.out_end()) ==
-               type_size<complex_type>(extended_size_));
+    Real* right_input()
+    {
+        return fft_right_.in_begin();
+    }
 
-        for (int i = 0; i < tmp_.size(); i++)
+    // Correlates the signals that have been written into the input buffers
+    int operator()(int oversampling_factor)
+    {
+        // the forward outputs are checked as part of the cross spectrum below
+        fft_left_.transform(size_);
+        assert(std::distance(fft_left_.out_begin(), fft_left_.out_end()) ==
+               type_size<std::complex<Real>>(extended_size_));
+
+        fft_right_.transform(size_);
+        assert(std::distance(fft_right_.out_begin(), fft_right_.out_end()) ==
+               type_size<std::complex<Real>>(extended_size_));
+
+        // write the cross spectrum directly into the input of the inverse transform
+        assert(ifft_.in_size() == fft_left_.out_size());
+        if (!cross_spectrum(fft_left_.out_begin(), fft_right_.out_begin(), ifft_.in_begin(),
+                            ifft_.in_size()))
         {
-            auto other = fft_.out_begin()[i];
-            // complex conjugate
-            other.imag(-other.imag());
-            tmp_[i] *= other;
-            check_finite(tmp_[i]);
+            throw std::runtime_error("Infinite complex value");
         }
 
-        ifft_(tmp_.begin(), tmp_.end());
+        ifft_.transform(ifft_.in_size());
         assert(std::distance(ifft_.out_begin(), ifft_.out_end()) == extended_size_);
 
-        ifft_.check_finite();
-
-        auto mainlobe = std::max_element(ifft_.out_begin(), ifft_.out_end(),
-                                         [](auto a, auto b)
-                                         {
-                                             if (!std::isfinite(a) || !std::isfinite(b))
-                                             {
-                                                 return false;
-                                             }
-                                             return a < b;
-                                         });
-
-        auto correlation_filename = scorep::environment_variable::get("CORRELATION_FILE");
-        if (!correlation_filename.empty())
+        auto lobes = find_lobes(ifft_.out_begin(), ifft_.out_size(), oversampling_factor);
+        if (!lobes.finite)
         {
-            correlation_filename += std::to_string(cnt);
-            std::ofstream file;
-            file.exceptions(std::ofstream::badbit);
-            file.open(correlation_filename);
-            for (auto it = ifft_.out_begin(); it != ifft_.out_end(); ++it)
-            {
-                file << *it << "\n";
-            }
+            throw std::runtime_error("Infinite value");
         }
 
-        auto mainlobe_index = std::distance(ifft_.out_begin(), mainlobe);
-
-        // determine the sidelobe.
-        // need to consider the circular fashion here
-        auto sidelobe_value = std::numeric_limits<double>::lowest();
-        for (int i = 0; i < ifft_.out_size(); ++i)
+        auto correlation_filename = scorep::environment_variable::get("CORRELATION_FILE");
+        if (!correlation_filename.empty())
         {
-            const auto value = fabs(ifft_.out_begin()[i]);
-            if (value > sidelobe_value)
-            {
-                auto distance = std::min((i - mainlobe_index) % ifft_.out_size(),
-                                         (mainlobe_index - i) % ifft_.out_size());
-                if (distance >= oversampling_factor)
-                {
-                    sidelobe_value = value;
-                }
-            }
+            // the forward transforms preserve their inputs
+            CorrelationDumpHeader header{};
+            header.interval_ns = interval_.count();
+            header.oversampling = oversampling_factor;
+            header.input_size = size_;
+            header.correlation_size = ifft_.out_size();
+            header.mainlobe_index = lobes.mainlobe_index;
+            header.sidelobe_index = lobes.sidelobe_index;
+            header.mainlobe = lobes.mainlobe;
+            header.sidelobe = lobes.sidelobe;
+            write_correlation_dump(correlation_filename + tag_, header, tag_, left_input(),
+                                   right_input(), ifft_.out_begin());
         }
 
+        std::ptrdiff_t mainlobe_index = lobes.mainlobe_index;
         if (mainlobe_index >= size_)
         {
             mainlobe_index -= ifft_.out_size();
         }
-        auto sidelobe_factor = *mainlobe / sidelobe_value;
-        Log::debug() << "Found max correlation with offset " << mainlobe_index << ": " << *mainlobe;
+        auto sidelobe_factor = lobes.mainlobe / lobes.sidelobe;
+        quality_ = sidelobe_factor;
+        Log::debug() << "Found max correlation with offset " << mainlobe_index << ": "
+                     << lobes.mainlobe;
         if (sidelobe_factor < 3)
         {
             Log::warn() << "The time synchronization probably did not work (" << sidelobe_factor
@@ -111,6 +109,18 @@ public:
         return -mainlobe_index;
     };
 
+    template <typename T1, typename T2>
+    int operator()(T1 left_begin, T1 left_end, T2 right_begin, T2 right_end,
+                   int oversampling_factor)
+    {
+        assert(std::distance(left_begin, left_end) == size_);
+        assert(std::distance(right_begin, right_end) == size_);
+
+        std::copy(left_begin, left_end, left_input());
+        std::copy(right_begin, right_end, right_input());
+        return (*this)(oversampling_factor);
+    }
+
     template <typename T1, typename T2>
     auto operator()(T1 left, T2 right, int oversampling_factor)
     {
@@ -121,9 +131,11 @@ public:
 
 private:
     std::string tag_;
+    metricq::Duration interval_;
     std::size_t size_;
     std::size_t extended_size_;
-    FFT fft_;
-    IFFT ifft_;
-    std::vector<complex_type> tmp_;
+    FFT<Real> fft_left_;
+    FFT<Real> fft_right_;
+    IFFT<Real> ifft_;
+    double quality_ = 0.;
 };
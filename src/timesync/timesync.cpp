@@ -1,5 +1,7 @@
 #include "timesync.hpp"
 
+#include "../flag.hpp"
+
 namespace timesync
 {
 
@@ -19,5 +21,173 @@ CCTimeSync::CCTimeSync()
     {
         sampling_interval_ = metricq::duration_parse(sampling_str);
     }
+    if (auto tolerance_str = scorep::environment_variable::get("SYNC_TOLERANCE");
+        !tolerance_str.empty())
+    {
+        tolerance_ = metricq::duration_parse(tolerance_str);
+    }
+    if (auto threads_str = scorep::environment_variable::get("SYNC_FOOTPRINT_THREADS");
+        !threads_str.empty())
+    {
+        footprint_threads_ = std::stoi(threads_str);
+    }
+    if (auto kernel_str = scorep::environment_variable::get("SYNC_FOOTPRINT_KERNEL", "scalar");
+        kernel_str == "fma")
+    {
+        footprint_kernel_ = FootprintKernel::fma;
+    }
+    else if (kernel_str == "stream")
+    {
+        footprint_kernel_ = FootprintKernel::stream;
+    }
+    else if (kernel_str != "scalar")
+    {
+        Log::error() << "Invalid kernel specified in "
+                     << scorep::environment_variable::name("SYNC_FOOTPRINT_KERNEL")
+                     << ", using scalar.";
+    }
+    if (auto granularity_str = scorep::environment_variable::get("SYNC_FOOTPRINT_GRANULARITY");
+        !granularity_str.empty())
+    {
+        footprint_granularity_ = std::stoi(granularity_str);
+    }
+    if (auto adaptive_str = scorep::environment_variable::get("SYNC_ADAPTIVE");
+        !adaptive_str.empty())
+    {
+        adaptive_ = parse_flag(adaptive_str);
+    }
+    if (auto threshold_str = scorep::environment_variable::get("SYNC_ADAPTIVE_THRESHOLD");
+        !threshold_str.empty())
+    {
+        adaptive_threshold_ = std::stod(threshold_str);
+    }
+    if (auto margin_str = scorep::environment_variable::get("SYNC_ADAPTIVE_MARGIN");
+        !margin_str.empty())
+    {
+        adaptive_margin_ = metricq::duration_parse(margin_str);
+    }
+    if (auto interval_str = scorep::environment_variable::get("SYNC_MARKER_INTERVAL");
+        !interval_str.empty())
+    {
+        marker_interval_ = metricq::duration_parse(interval_str);
+    }
+    if (auto exponent_str = scorep::environment_variable::get("SYNC_MARKER_EXPONENT");
+        !exponent_str.empty())
+    {
+        marker_exponent_ = std::stoi(exponent_str);
+    }
+    if (auto margin_str = scorep::environment_variable::get("SYNC_MARKER_MARGIN");
+        !margin_str.empty())
+    {
+        marker_margin_ = metricq::duration_parse(margin_str);
+    }
+    if (auto mode_str = scorep::environment_variable::get("SYNC_MODE", "first");
+        mode_str == "each")
+    {
+        mode_ = SyncMode::each;
+    }
+    else if (mode_str == "best")
+    {
+        mode_ = SyncMode::best;
+    }
+    else if (mode_str != "first")
+    {
+        Log::error() << "Invalid mode specified in "
+                     << scorep::environment_variable::name("SYNC_MODE") << ", using first.";
+    }
+    if (auto precision_str = scorep::environment_variable::get("SYNC_PRECISION", "double");
+        precision_str == "float")
+    {
+#ifdef ENABLE_FFTW_FLOAT
+        single_precision_ = true;
+#else
+        Log::error() << "Single precision time synchronization is not available, fftw3f was not "
+                        "found at build time.";
+#endif
+    }
+    else if (precision_str != "double")
+    {
+        Log::error() << "Invalid precision specified in "
+                     << scorep::environment_variable::name("SYNC_PRECISION") << ", using double.";
+    }
+    if (auto search_str = scorep::environment_variable::get("SYNC_SEARCH", "full");
+        search_str == "hierarchical")
+    {
+        search_ = SyncSearch::hierarchical;
+    }
+    else if (search_str == "edges")
+    {
+        search_ = SyncSearch::edges;
+    }
+    else if (search_str != "full")
+    {
+        Log::error() << "Invalid search specified in "
+                     << scorep::environment_variable::name("SYNC_SEARCH") << ", using full.";
+    }
+    if (search_ == SyncSearch::edges)
+    {
+        // there are no transforms and no circular correlation to write
+        if (single_precision_)
+        {
+            Log::warn() << scorep::environment_variable::name("SYNC_PRECISION")
+                        << " has no effect on the edges search";
+        }
+        if (!scorep::environment_variable::get("CORRELATION_FILE").empty())
+        {
+            Log::warn() << "The edges search does not write "
+                        << scorep::environment_variable::name("CORRELATION_FILE");
+        }
+    }
+}
+
+CCTimeSync::~CCTimeSync()
+{
+    stop_markers();
+}
+
+void CCTimeSync::start_markers()
+{
+    Log::debug() << "playing a sync marker with exponent " << marker_exponent_ << " every "
+                 << marker_interval_;
+    marker_stop_.store(false);
+    marker_thread_ = std::thread(
+        [this]()
+        {
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(marker_mutex_);
+                    if (marker_stop_cv_.wait_for(lock, marker_interval_,
+                                                 [this]() { return marker_stop_.load(); }))
+                    {
+                        return;
+                    }
+                }
+
+                auto marker = make_marker();
+                marker->run([this]() { return marker_stop_.load(std::memory_order_relaxed); });
+                if (marker_stop_.load())
+                {
+                    // the marker may be incomplete
+                    return;
+                }
+                markers_.push_back(std::move(marker));
+            }
+        });
+}
+
+void CCTimeSync::stop_markers()
+{
+    if (!marker_thread_.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(marker_mutex_);
+        marker_stop_.store(true);
+    }
+    marker_stop_cv_.notify_all();
+    marker_thread_.join();
+    Log::debug() << "played " << markers_.size() << " sync markers";
 }
 } // namespace timesync
@@ -9,9 +9,15 @@
 #include <metricq/logger/nitro.hpp>
 #include <metricq/ostream.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 #include <cmath>
@@ -20,17 +26,32 @@ namespace timesync
 {
 using Log = metricq::logger::nitro::Log;
 
+// First element of a recording sorted by time that is not before tp
+template <typename T, typename TP>
+auto find_time(const T& recording, TP tp)
+{
+    using std::begin;
+    using std::end;
+    return std::partition_point(begin(recording), end(recording),
+                                [tp](const auto& tv) { return tv.time < tp; });
+}
+
+// Values of the recording at the points time_begin + n * interval before time_end, each taking
+// the first record at or after the point. The start position is found by binary search.
 template <typename T, typename TP, typename DUR>
 std::vector<double> sample(const T& recording, TP time_begin, TP time_end, DUR interval)
 {
     using std::begin;
     using std::end;
-    auto it = begin(recording);
-
-    assert(!recording.empty());
 
     assert(time_begin <= time_end);
 
+    if (begin(recording) == end(recording))
+    {
+        throw std::out_of_range("Insufficient time range for sampling - the recording is empty");
+    }
+    auto it = find_time(recording, time_begin);
+
     std::vector<double> output;
     output.reserve((time_end - time_begin) / interval);
     for (auto tp = time_begin; tp < time_end; tp += interval)
@@ -55,111 +76,862 @@ std::vector<double> sample(const T& recording, TP time_begin, TP time_end, DUR i
     return output;
 }
 
+// Number of values sample() produces for the range
+template <typename TP, typename DUR>
+std::size_t sample_count(TP time_begin, TP time_end, DUR interval)
+{
+    assert(time_begin <= time_end);
+    return ((time_end - time_begin).count() + interval.count() - 1) / interval.count();
+}
+
+// Resamples the footprint and the measured signal at the same size points in a single pass, with
+// the same semantics as sample(). The start positions are found by binary search. The values are
+// written to the outputs and the mean of the measured signal is returned.
+template <typename T1, typename T2, typename TP, typename DUR, typename V>
+double resample(const T1& footprint, const T2& measured, TP time_begin, std::size_t size,
+                DUR interval, V* footprint_out, V* measured_out)
+{
+    using std::end;
+    auto footprint_it = find_time(footprint, time_begin);
+    auto measured_it = find_time(measured, time_begin);
+    const auto footprint_end = end(footprint);
+    const auto measured_end = end(measured);
+
+    double sum = 0.;
+    auto tp = time_begin;
+    for (std::size_t i = 0; i < size; i++, tp += interval)
+    {
+        while (footprint_it != footprint_end && footprint_it->time < tp)
+        {
+            ++footprint_it;
+        }
+        while (measured_it != measured_end && measured_it->time < tp)
+        {
+            ++measured_it;
+        }
+        if (footprint_it == footprint_end || measured_it == measured_end)
+        {
+            Log::error() << "Failed to sample in range " << time_begin << " to "
+                         << time_begin + size * interval;
+            throw std::out_of_range(
+                "Insufficient time range for sampling - maybe clock drift is too large?");
+        }
+
+        // now: tp <= it->time
+        footprint_out[i] = footprint_it->value;
+        measured_out[i] = measured_it->value;
+        sum += measured_it->value;
+    }
+    return sum / size;
+}
+
+// Like sample(), but each output value is the mean of all samples within [tp, tp + interval).
+// Used for coarse resampling, where picking single samples would mostly pick noise.
+template <typename T, typename TP, typename DUR>
+std::vector<double> sample_mean(const T& recording, TP time_begin, TP time_end, DUR interval)
+{
+    using std::begin;
+    using std::end;
+
+    assert(time_begin <= time_end);
+
+    if (begin(recording) == end(recording))
+    {
+        throw std::out_of_range("Insufficient time range for sampling - the recording is empty");
+    }
+    auto it = find_time(recording, time_begin);
+    if (it == begin(recording) && time_begin < it->time)
+    {
+        // the first bins would be empty or only partially covered
+        Log::error() << "Failed to sample in range " << time_begin << " to " << time_end;
+        throw std::out_of_range("Insufficient time range for sampling - the range begins before "
+                                "the recording");
+    }
+
+    std::vector<double> output;
+    output.reserve((time_end - time_begin) / interval);
+    for (auto tp = time_begin; tp < time_end; tp += interval)
+    {
+        while (it != end(recording) && (it->time < tp))
+        {
+            it++;
+        }
+        if (it == end(recording))
+        {
+            Log::error() << "Failed to sample in range " << time_begin << " to " << time_end;
+            throw std::out_of_range(
+                "Insufficient time range for sampling - maybe clock drift is too large?");
+        }
+
+        double sum = 0.;
+        std::size_t count = 0;
+        for (; it != end(recording) && it->time < tp + interval; ++it)
+        {
+            sum += it->value;
+            count++;
+        }
+        // an empty bin takes the next sample, like sample(), it exists as the bin was checked
+        output.push_back(count > 0 ? sum / count : it->value);
+    }
+    return output;
+}
+
+// Direct cross-correlation for a small number of lags:
+// result[j] = sum_n footprint[n] * measured[n + j], measured must cover all lags
+inline std::vector<double> correlate_lags(const std::vector<double>& footprint,
+                                          const std::vector<double>& measured, std::size_t lags)
+{
+    assert(measured.size() + 1 >= footprint.size() + lags);
+    std::vector<double> result(lags);
+    for (std::size_t j = 0; j < lags; j++)
+    {
+        const auto* m = measured.data() + j;
+        double sum = 0.;
+#pragma omp simd reduction(+ : sum)
+        for (std::size_t n = 0; n < footprint.size(); n++)
+        {
+            sum += footprint[n] * m[n];
+        }
+        result[j] = sum;
+    }
+    return result;
+}
+
+// Correlation of a footprint recording with the measured signal for all lags in
+// [-max_lag, max_lag] sampling intervals, with the same sampling semantics as sample():
+// result[max_lag + d] = sum_n footprint[n] * measured[n + d] over size points from time_begin on.
+// The footprint is constant within each of its runs, so the sum over a run is a difference of two
+// prefix sums of the measured signal. This costs O(runs * lags) and neither the footprint nor the
+// correlation of all circular lags are materialized.
+template <typename T1, typename T2, typename TP, typename DUR>
+std::vector<double> correlate_runs(const T1& footprint, const T2& measured, TP time_begin,
+                                   std::size_t size, DUR interval, std::size_t max_lag)
+{
+    using std::end;
+    const auto lag = static_cast<std::int64_t>(max_lag);
+    auto measured_begin = time_begin - lag * interval;
+    auto measured_size = size + 2 * max_lag;
+
+    // the prefix sums are built while sampling, the mean is subtracted afterwards
+    std::vector<double> prefix(measured_size + 1);
+    prefix[0] = 0.;
+    auto measured_it = find_time(measured, measured_begin);
+    const auto measured_end = end(measured);
+    auto tp = measured_begin;
+    for (std::size_t i = 0; i < measured_size; i++, tp += interval)
+    {
+        while (measured_it != measured_end && measured_it->time < tp)
+        {
+            ++measured_it;
+        }
+        if (measured_it == measured_end)
+        {
+            Log::error() << "Failed to sample in range " << measured_begin << " to "
+                         << measured_begin + static_cast<std::int64_t>(measured_size) * interval;
+            throw std::out_of_range(
+                "Insufficient time range for sampling - maybe clock drift is too large?");
+        }
+        prefix[i + 1] = prefix[i] + measured_it->value;
+    }
+    auto average = prefix[measured_size] / measured_size;
+    for (std::size_t i = 1; i <= measured_size; i++)
+    {
+        prefix[i] -= average * i;
+    }
+
+    // Each point n takes the value of the first record at or after its time. So the record k
+    // covers [count(t_k-1), count(t_k)), where count(t) is the number of points not after t.
+    auto count = [&](TP time)
+    {
+        if (time < time_begin)
+        {
+            return std::size_t(0);
+        }
+        return std::min(size, static_cast<std::size_t>((time - time_begin) / interval) + 1);
+    };
+    // The sum over a run is prefix[end + s] - prefix[begin + s] for s = d + max_lag, and the end
+    // of each run is the begin of the next one, so both terms of a boundary are merged.
+    std::vector<std::size_t> edges;
+    std::vector<double> weights;
+    auto add_edge = [&](std::size_t edge, double weight)
+    {
+        if (!edges.empty() && edges.back() == edge)
+        {
+            weights.back() += weight;
+        }
+        else
+        {
+            edges.push_back(edge);
+            weights.push_back(weight);
+        }
+    };
+    std::size_t begin = 0;
+    for (const auto& tv : footprint)
+    {
+        if (begin == size)
+        {
+            break;
+        }
+        auto end = count(tv.time);
+        if (end > begin)
+        {
+            add_edge(begin, -tv.value);
+            add_edge(end, tv.value);
+            begin = end;
+        }
+    }
+    if (begin < size)
+    {
+        Log::error() << "Failed to sample in range " << time_begin << " to "
+                     << time_begin + static_cast<std::int64_t>(size) * interval;
+        throw std::out_of_range(
+            "Insufficient time range for sampling - maybe clock drift is too large?");
+    }
+
+    std::vector<double> result(2 * max_lag + 1);
+    correlate_edges(prefix.data(), edges.data(), weights.data(), edges.size(), result.data(),
+                    result.size());
+    return result;
+}
+
+// Linear mapping from the clock of a measurement to the local clock
+struct LinearMapping
+{
+    double time_rate = 1.0;          // local time per measurement time
+    metricq::Duration offset_zero{}; // diff between local time and measurement time
+
+    metricq::TimePoint to_local(metricq::TimePoint measurement_time) const
+    {
+        return metricq::TimePoint(
+                   metricq::duration_cast(measurement_time.time_since_epoch() * time_rate)) +
+               offset_zero;
+    }
+};
+
+// Piecewise-linear mapping from the clock of a measurement to the local clock, with one segment
+// between each pair of consecutive sync points. The first and last segment are extrapolated.
+struct TimeMapping
+{
+    std::vector<metricq::TimePoint> begins; // measurement time at which each segment begins
+    std::vector<LinearMapping> segments;
+    double quality = 0.; // lowest main-sidelobe factor of all correlations
+
+    // Interpolates between sync points, each given as (measurement time, local time)
+    static TimeMapping
+    from_points(const std::vector<std::pair<metricq::TimePoint, metricq::TimePoint>>& points)
+    {
+        assert(points.size() >= 2);
+        TimeMapping mapping;
+        for (std::size_t i = 0; i + 1 < points.size(); i++)
+        {
+            auto [measurement_begin, local_begin] = points[i];
+            auto [measurement_end, local_end] = points[i + 1];
+            LinearMapping segment;
+            segment.time_rate = static_cast<double>((local_end - local_begin).count()) /
+                                (measurement_end - measurement_begin).count();
+            segment.offset_zero =
+                local_begin - LinearMapping{ segment.time_rate }.to_local(measurement_begin);
+            mapping.begins.push_back(measurement_begin);
+            mapping.segments.push_back(segment);
+        }
+        return mapping;
+    }
+
+    std::size_t segment(metricq::TimePoint measurement_time) const
+    {
+        assert(!segments.empty());
+        auto it = std::upper_bound(begins.begin() + 1, begins.end(), measurement_time);
+        return std::distance(begins.begin(), it) - 1;
+    }
+
+    metricq::TimePoint to_local(metricq::TimePoint measurement_time) const
+    {
+        return segments[segment(measurement_time)].to_local(measurement_time);
+    }
+
+    // For measurement times in ascending order, segment is the index of the segment of the
+    // previous call and is advanced as needed, starting at 0
+    metricq::TimePoint to_local(metricq::TimePoint measurement_time, std::size_t& segment) const
+    {
+        while (segment + 1 < segments.size() && begins[segment + 1] <= measurement_time)
+        {
+            segment++;
+        }
+        return segments[segment].to_local(measurement_time);
+    }
+};
+
+// Which of the high-rate metrics are correlated with the footprints
+enum class SyncMode
+{
+    first, // the first metric that can be synchronized, its mapping is used for all
+    each,  // every metric independently with its own mapping
+    best   // every metric, the mapping with the best quality is used for all
+};
+
+// How the offset of the measured signal is searched
+enum class SyncSearch
+{
+    full,         // FFT correlation of the whole footprint at the sampling interval
+    hierarchical, // coarse FFT correlation, refined directly around the best lag
+    edges         // direct correlation of all lags within the tolerance via the footprint runs
+};
+
+// Offset of the measured signal in sampling intervals
+struct Offset
+{
+    std::int64_t samples;
+    double quality;
+};
+
 class CCTimeSync
 {
 public:
     CCTimeSync();
+    ~CCTimeSync();
+
+    SyncMode mode() const
+    {
+        return mode_;
+    }
 
     void sync_begin()
     {
         Log::debug() << "using a footprint sequence with exponent " << footprint_msequence_exponent_
                      << " and a time quantum of " << footprint_quantum_;
 
-        footprint_begin_ =
-            std::make_unique<Footprint>(footprint_msequence_exponent_, footprint_quantum_);
+        footprint_begin_ = make_footprint(footprint_msequence_exponent_, tolerance_);
+        footprint_begin_->run();
+
+        if (marker_interval_.count() > 0)
+        {
+            start_markers();
+        }
     }
 
     void sync_end()
     {
-        footprint_end_ =
-            std::make_unique<Footprint>(footprint_msequence_exponent_, footprint_quantum_);
+        stop_markers();
+        footprint_end_ = make_footprint(footprint_msequence_exponent_, tolerance_);
+        footprint_end_->run();
+    }
+
+    bool adaptive() const
+    {
+        return adaptive_;
+    }
+
+    // Like sync_end(), but uses the signal that has been streamed during the measurement to
+    // shorten the end phase. signal(from, to) must return a copy of the samples streamed so far
+    // within [from, to] and the first one after to.
+    // The offset of the begin phase bounds the padding, and the pattern is stopped as soon as a
+    // correlation of its recorded part with the live signal is confident enough.
+    template <typename Access>
+    void sync_end_adaptive(Access&& signal)
+    {
+        stop_markers();
+
+        Offset begin;
+        try
+        {
+            // the searches may look beyond the sync phase by up to its duration
+            auto duration = footprint_begin_->time_end() - footprint_begin_->time_begin();
+            auto begin_signal = signal(footprint_begin_->time_begin() - duration,
+                                       footprint_begin_->time_end() + duration);
+            begin = find_offset(*footprint_begin_, begin_signal, "begin-live");
+        }
+        catch (std::exception& e)
+        {
+            Log::warn() << "Adaptive time sync not possible, no offset for the begin phase: "
+                        << e.what();
+            sync_end();
+            return;
+        }
+
+        auto expected_offset = begin.samples * sampling_interval_;
+        auto tolerance = std::min<metricq::Duration>(
+            tolerance_, metricq::Duration(std::abs(expected_offset.count())) + adaptive_margin_);
+        Log::debug() << "adaptive end phase with expected offset " << expected_offset
+                     << " and tolerance " << tolerance;
+
+        footprint_end_ = make_footprint(footprint_msequence_exponent_, tolerance);
+        const auto& footprint = *footprint_end_;
+
+        std::atomic<bool> confident{ false };
+        std::atomic<bool> finished{ false };
+        std::thread monitor(
+            [&]()
+            {
+                // only check after a fraction of the sequence, short parts correlate by chance
+                auto min_duration =
+                    footprint_quantum_ * (std::int64_t(1) << (footprint_msequence_exponent_ - 3));
+                while (!finished.load())
+                {
+                    std::this_thread::sleep_for(adaptive_check_interval_);
+                    auto recording = footprint.recording_snapshot();
+                    if (recording.size() < 2 ||
+                        recording.back().time - recording.front().time < min_duration)
+                    {
+                        continue;
+                    }
+                    double quality = 0.;
+                    try
+                    {
+                        auto padding = adaptive_margin_ +
+                                       std::max(sampling_interval_, footprint_quantum_);
+                        auto from = recording.front().time + expected_offset - padding;
+                        auto to = recording.back().time + expected_offset + padding;
+                        auto live_signal = signal(from, to);
+                        quality =
+                            live_quality(recording, live_signal, expected_offset, adaptive_margin_);
+                    }
+                    catch (std::out_of_range&)
+                    {
+                        // the data for the recorded part has not arrived yet
+                        continue;
+                    }
+                    catch (std::exception& e)
+                    {
+                        Log::warn() << "Live correlation failed, playing the whole pattern: "
+                                    << e.what();
+                        return;
+                    }
+                    Log::debug() << "live correlation quality: " << quality;
+                    if (quality >= adaptive_threshold_)
+                    {
+                        confident.store(true);
+                        return;
+                    }
+                }
+            });
+
+        // a joinable monitor must not be destroyed if the pattern throws
+        struct Join
+        {
+            std::atomic<bool>& finished;
+            std::thread& monitor;
+
+            ~Join()
+            {
+                finished.store(true);
+                monitor.join();
+            }
+        } join{ finished, monitor };
+
+        footprint_end_->run([&confident]() { return confident.load(std::memory_order_relaxed); });
     }
 
+    // Number of threads each FFT of the configured search runs on
+    int fft_threads() const
+    {
+        if (search_ == SyncSearch::edges)
+        {
+            return 1;
+        }
+#ifdef ENABLE_FFTW_FLOAT
+        if (single_precision_)
+        {
+            return FFTPlanner<float>::instance().threads();
+        }
+#endif
+        return FFTPlanner<double>::instance().threads();
+    }
+
+    // Correlates both footprints with the measured signal to map its clock to the local one.
+    // The name distinguishes the correlation files of different signals.
     template <typename T>
-    auto find_offsets(const T& measured_raw_signal)
+    TimeMapping find_offsets(const T& measured_raw_signal, const std::string& name) const
     {
         assert(footprint_begin_);
         assert(footprint_end_);
-        Log::debug() << "find begin offsets...";
-        auto offset_begin =
-            find_offset(*footprint_begin_, measured_raw_signal, "begin") * sampling_interval_;
-        Log::debug() << "find end offsets...";
-        auto offset_end =
-            find_offset(*footprint_end_, measured_raw_signal, "end") * sampling_interval_;
-
-        auto footprint_duration = footprint_end_->time() - footprint_begin_->time();
-        auto measurement_duration = footprint_duration + offset_end - offset_begin;
-        time_rate_ = static_cast<double>(footprint_duration.count()) / measurement_duration.count();
-        offset_zero_ = footprint_begin_->time() -
-                       time_point_scale(footprint_begin_->time() + offset_begin, time_rate_);
+        // both searches only read the signal, so they run concurrently, unless the FFTs already
+        // use several threads each
+        Log::debug() << "find begin and end offsets...";
+        auto policy = fft_threads() > 1 ? std::launch::deferred : std::launch::async;
+        auto future_begin = std::async(policy,
+                                       [this, &measured_raw_signal, &name]() {
+                                           return find_offset(*footprint_begin_,
+                                                              measured_raw_signal, name + "-begin");
+                                       });
+        auto end = find_offset(*footprint_end_, measured_raw_signal, name + "-end");
+        auto begin = future_begin.get();
+        auto offset_begin = begin.samples * sampling_interval_;
+        auto offset_end = end.samples * sampling_interval_;
+
+        std::vector<std::pair<metricq::TimePoint, metricq::TimePoint>> points;
+        points.emplace_back(footprint_begin_->time() + offset_begin, footprint_begin_->time());
+        points.emplace_back(footprint_end_->time() + offset_end, footprint_end_->time());
+        auto mapping = TimeMapping::from_points(points);
+        mapping.quality = std::min(begin.quality, end.quality);
 
         Log::debug() << "offsets " << offset_begin << ", " << offset_end
-                     << ", rate: " << time_rate_;
-        Log::debug() << "Offset0: " << offset_zero_.count();
-    }
+                     << ", rate: " << mapping.segments[0].time_rate;
+        Log::debug() << "Offset0: " << mapping.segments[0].offset_zero.count();
 
-    metricq::TimePoint to_local(metricq::TimePoint measurement_time)
-    {
-        return time_point_scale(measurement_time, time_rate_) + offset_zero_;
+        if (markers_.empty())
+        {
+            return mapping;
+        }
+
+        // the linear mapping predicts the offsets of the markers, so only a small range of lags
+        // around them has to be searched
+        const auto& linear = mapping.segments[0];
+        points.pop_back();
+        for (std::size_t i = 0; i < markers_.size(); i++)
+        {
+            const auto& marker = *markers_[i];
+            auto local = marker.time();
+            auto expected_offset =
+                metricq::duration_cast((local - linear.offset_zero).time_since_epoch() /
+                                       linear.time_rate) -
+                local.time_since_epoch();
+            try
+            {
+                auto offset =
+                    find_offset_near(marker, measured_raw_signal, expected_offset, marker_margin_);
+                if (offset.quality < marker_threshold_)
+                {
+                    Log::warn() << "Skipping sync marker " << i << " with quality "
+                                << offset.quality;
+                    continue;
+                }
+                Log::debug() << "marker " << i << " offset "
+                             << offset.samples * sampling_interval_ << ", expected "
+                             << expected_offset;
+                points.emplace_back(local + offset.samples * sampling_interval_, local);
+                mapping.quality = std::min(mapping.quality, offset.quality);
+            }
+            catch (std::exception& e)
+            {
+                Log::warn() << "Skipping sync marker " << i << ": " << e.what();
+            }
+        }
+        points.emplace_back(footprint_end_->time() + offset_end, footprint_end_->time());
+
+        auto quality = mapping.quality;
+        mapping = TimeMapping::from_points(points);
+        mapping.quality = quality;
+        Log::debug() << "piecewise mapping with " << mapping.segments.size() << " segments";
+        return mapping;
     }
 
     std::vector<metricq::TimeValue> get_correlation_signal_values() const
     {
         std::vector<metricq::TimeValue> result = footprint_begin_->recording();
+        for (const auto& marker : markers_)
+        {
+            result.insert(result.end(), marker->recording().begin(), marker->recording().end());
+        }
         result.insert(result.end(), footprint_end_->recording().begin(),
                       footprint_end_->recording().end());
         return result;
     }
 
 private:
-    static metricq::TimePoint time_point_scale(metricq::TimePoint time, double factor)
+    std::unique_ptr<Footprint> make_footprint(int exponent, metricq::Duration tolerance) const
     {
-        return metricq::TimePoint(metricq::duration_cast(time.time_since_epoch() * factor));
+        return std::make_unique<Footprint>(exponent, footprint_quantum_, tolerance,
+                                           footprint_threads_, footprint_kernel_,
+                                           footprint_granularity_);
     }
 
+    // Markers run while the application does, so they only load the first CPU of the process
+    std::unique_ptr<Footprint> make_marker() const
+    {
+        return std::make_unique<Footprint>(marker_exponent_, footprint_quantum_, marker_margin_, 1,
+                                           footprint_kernel_, footprint_granularity_);
+    }
+
+    // Plays a short footprint every marker_interval_ on a separate thread until stop_markers()
+    void start_markers();
+    void stop_markers();
+
     template <typename T>
-    auto find_offset(Footprint& footprint, const T& measured_raw_signal, const std::string& tag)
+    Offset find_offset(const Footprint& footprint, const T& measured_raw_signal,
+                       const std::string& tag) const
+    {
+        if (search_ == SyncSearch::edges)
+        {
+            return find_offset_edges(footprint, measured_raw_signal);
+        }
+#ifdef ENABLE_FFTW_FLOAT
+        if (single_precision_)
+        {
+            if (search_ == SyncSearch::hierarchical)
+            {
+                return find_offset_hierarchical<float>(footprint, measured_raw_signal, tag);
+            }
+            return find_offset_full<float>(footprint, measured_raw_signal, tag);
+        }
+#endif
+        if (search_ == SyncSearch::hierarchical)
+        {
+            return find_offset_hierarchical<double>(footprint, measured_raw_signal, tag);
+        }
+        return find_offset_full<double>(footprint, measured_raw_signal, tag);
+    }
+
+    // Main-sidelobe factor of a coarse correlation of a partial footprint recording with the
+    // measured signal, for lags within margin around the expected offset
+    template <typename T>
+    double live_quality(const std::vector<metricq::TimeValue>& recording, const T& measured,
+                        metricq::Duration expected_offset, metricq::Duration margin) const
+    {
+        auto interval = std::max<metricq::Duration>(sampling_interval_, footprint_quantum_ / 4);
+        auto begin = recording.front().time;
+        auto size = static_cast<std::int64_t>(sample_count(begin, recording.back().time, interval));
+        auto lags = 2 * (margin / interval) + 1;
+
+        auto footprint_signal = sample(recording, begin, begin + size * interval, interval);
+        auto measured_begin = begin + expected_offset - (margin / interval) * interval;
+        auto measured_end = measured_begin + (size + lags - 1) * interval;
+        auto measured_signal = sample_mean(measured, measured_begin, measured_end, interval);
+        auto average = std::accumulate(measured_signal.begin(), measured_signal.end(), 0.0) /
+                       measured_signal.size();
+        for (auto& elem : measured_signal)
+        {
+            elem -= average;
+        }
+
+        auto correlation = correlate_lags(footprint_signal, measured_signal, lags);
+        auto lobes = find_lobes(correlation.data(), correlation.size(),
+                                footprint_quantum_ / interval, false);
+        return lobes.mainlobe / lobes.sidelobe;
+    }
+
+    // Correlates the whole footprint at sampling_interval_ resolution
+    template <typename Real, typename T>
+    Offset find_offset_full(const Footprint& footprint, const T& measured_raw_signal,
+                            const std::string& tag) const
     {
         auto st_begin = footprint.time_begin();
         auto st_end = footprint.time_end();
 
-        Log::debug() << "Sampling footprint from " << st_begin.time_since_epoch().count() << " to "
+        auto size = sample_count(st_begin, st_end, sampling_interval_);
+        assert(size > 0);
+        Log::debug() << "looking for shift in " << size << " data points";
+        Shifter<Real> shifter(size, sampling_interval_, tag);
+
+        Log::debug() << "Sampling footprint and raw signal from "
+                     << st_begin.time_since_epoch().count() << " to "
                      << st_end.time_since_epoch().count() << " with interval "
                      << sampling_interval_.count() << ":";
-        auto footprint_signal = sample(footprint.recording(), st_begin, st_end, sampling_interval_);
+        auto average = resample(footprint.recording(), measured_raw_signal, st_begin, size,
+                                sampling_interval_, shifter.left_input(), shifter.right_input());
+        Log::debug() << "Signal average: " << average;
+        auto measured_signal = shifter.right_input();
+        for (std::size_t i = 0; i < size; i++)
+        {
+            measured_signal[i] -= average;
+        }
+
+        auto offset = shifter(footprint_quantum_ / sampling_interval_);
+        return { offset, shifter.quality() };
+    }
+
+    // Correlates the footprint runs with the measured signal for all lags within the tolerance of
+    // the footprint, without FFTs
+    template <typename T>
+    Offset find_offset_edges(const Footprint& footprint, const T& measured_raw_signal) const
+    {
+        auto st_begin = footprint.time_begin();
+        auto size = sample_count(st_begin, footprint.time_end(), sampling_interval_);
+        auto max_lag = static_cast<std::size_t>(footprint.tolerance() / sampling_interval_);
+        Log::debug() << "correlating " << footprint.recording().size() << " runs with "
+                     << 2 * max_lag + 1 << " lags";
+
+        auto correlation = correlate_runs(footprint.recording(), measured_raw_signal, st_begin,
+                                          size, sampling_interval_, max_lag);
+        auto lobes = find_lobes(correlation.data(), correlation.size(),
+                                footprint_quantum_ / sampling_interval_, false);
+        if (!lobes.finite)
+        {
+            throw std::runtime_error("Infinite value");
+        }
+        auto offset = static_cast<std::int64_t>(lobes.mainlobe_index) -
+                      static_cast<std::int64_t>(max_lag);
+        auto quality = lobes.mainlobe / lobes.sidelobe;
+        Log::debug() << "Found max correlation with offset " << offset << ": " << lobes.mainlobe;
+        if (quality < 3)
+        {
+            Log::warn() << "The time synchronization probably did not work (" << quality << ")";
+        }
+        else
+        {
+            Log::debug() << "Correlation main-sidelobe-factor: " << quality;
+        }
+        return { offset, quality };
+    }
+
+    // Finds the lag with a cheap correlation at a few samples per quantum first, and then refines
+    // it at sampling_interval_ resolution only within two coarse samples around that lag.
+    template <typename Real, typename T>
+    Offset find_offset_hierarchical(const Footprint& footprint, const T& measured_raw_signal,
+                                    const std::string& tag) const
+    {
+        constexpr std::int64_t coarse_samples_per_quantum = 4;
 
-        Log::debug() << "Sampling raw signal:";
+        auto st_begin = footprint.time_begin();
+        auto st_end = footprint.time_end();
 
-        auto measured_signal = sample(measured_raw_signal, st_begin, st_end, sampling_interval_);
+        auto coarse_factor = std::max<std::int64_t>(
+            1, footprint_quantum_ / (sampling_interval_ * coarse_samples_per_quantum));
+        auto coarse_interval = sampling_interval_ * coarse_factor;
+
+        Log::debug() << "Coarse sampling with interval " << coarse_interval.count() << ":";
+        auto coarse_footprint = sample(footprint.recording(), st_begin, st_end, coarse_interval);
+        auto coarse_measured = sample_mean(measured_raw_signal, st_begin, st_end, coarse_interval);
+        auto coarse_average =
+            std::accumulate(coarse_measured.begin(), coarse_measured.end(), 0.0) /
+            coarse_measured.size();
+        for (auto& elem : coarse_measured)
+        {
+            elem -= coarse_average;
+        }
 
+        assert(coarse_measured.size() == coarse_footprint.size());
+        assert(!coarse_measured.empty());
+        Log::debug() << "looking for coarse shift in " << coarse_measured.size()
+                     << " data points";
+        Shifter<Real> shifter(coarse_measured.size(), coarse_interval, tag);
+        auto coarse_oversampling = std::max<std::int64_t>(1, footprint_quantum_ / coarse_interval);
+        auto coarse_offset = shifter(coarse_footprint, coarse_measured, coarse_oversampling);
+
+        // refine within +- 2 coarse samples, in units of sampling_interval_
+        Log::debug() << "Fine sampling around offset " << coarse_offset * coarse_interval << ":";
+        auto offset = refine_offset(footprint, measured_raw_signal, coarse_offset * coarse_factor,
+                                    2 * coarse_factor);
+        return { offset, shifter.quality() };
+    }
+
+    // Correlates the footprint at sampling_interval_ resolution with the lags within margin around
+    // the expected one, all in units of sampling_interval_
+    template <typename T>
+    std::int64_t refine_offset(const Footprint& footprint, const T& measured_raw_signal,
+                               std::int64_t expected, std::int64_t margin) const
+    {
+        auto st_begin = footprint.time_begin();
+        auto st_end = footprint.time_end();
+        auto first = expected - margin;
+        auto last = expected + margin;
+
+        // lags before the recording would repeat its first value, so they are left out
+        using std::begin;
+        using std::end;
+        if (begin(measured_raw_signal) == end(measured_raw_signal))
+        {
+            throw std::out_of_range(
+                "Insufficient time range for sampling - the recording is empty");
+        }
+        auto recording_begin = begin(measured_raw_signal)->time;
+        if (st_begin + first * sampling_interval_ < recording_begin)
+        {
+            auto missing = recording_begin - (st_begin + first * sampling_interval_);
+            first += (missing + sampling_interval_ - metricq::Duration(1)) / sampling_interval_;
+        }
+        if (first > last)
+        {
+            throw std::out_of_range("Insufficient time range for sampling - the refinement window "
+                                    "begins before the recording");
+        }
+        auto lags = static_cast<std::size_t>(last - first + 1);
+
+        auto footprint_signal = sample(footprint.recording(), st_begin, st_end, sampling_interval_);
+        auto measured_begin = st_begin + first * sampling_interval_;
+        auto measured_size = static_cast<std::int64_t>(footprint_signal.size() + lags - 1);
+        auto measured_signal = sample(measured_raw_signal, measured_begin,
+                                      measured_begin + measured_size * sampling_interval_,
+                                      sampling_interval_);
         auto average = std::accumulate(measured_signal.begin(), measured_signal.end(), 0.0) /
                        measured_signal.size();
-        Log::debug() << "Signal average: " << average;
         for (auto& elem : measured_signal)
         {
             elem -= average;
         }
 
-        assert(measured_signal.size() == footprint_signal.size());
-        assert(!measured_signal.empty());
-        Log::debug() << "looking for shift in " << measured_signal.size() << " data points";
+        auto correlation = correlate_lags(footprint_signal, measured_signal, lags);
+        auto best = std::max_element(correlation.begin(), correlation.end());
+        Log::debug() << "Found max fine correlation with offset "
+                     << first + std::distance(correlation.begin(), best) << ": " << *best;
+        return first + std::distance(correlation.begin(), best);
+    }
 
-        Shifter shifter(measured_signal.size(), tag);
-        auto result =
-            shifter(footprint_signal, measured_signal, footprint_quantum_ / sampling_interval_);
-        return result;
+    // Finds the offset of a short footprint, whose offset is known to be within margin around the
+    // expected one. The lags of that range are correlated directly at a few samples per quantum,
+    // then the best one is refined like in the hierarchical search.
+    template <typename T>
+    Offset find_offset_near(const Footprint& footprint, const T& measured_raw_signal,
+                            metricq::Duration expected_offset, metricq::Duration margin) const
+    {
+        constexpr std::int64_t coarse_samples_per_quantum = 4;
+
+        auto st_begin = footprint.time_begin();
+        auto st_end = footprint.time_end();
+
+        auto coarse_factor = std::max<std::int64_t>(
+            1, footprint_quantum_ / (sampling_interval_ * coarse_samples_per_quantum));
+        auto coarse_interval = sampling_interval_ * coarse_factor;
+        auto coarse_margin = margin / coarse_interval;
+        auto lags = static_cast<std::size_t>(2 * coarse_margin + 1);
+
+        auto coarse_footprint = sample(footprint.recording(), st_begin, st_end, coarse_interval);
+        auto first = expected_offset / sampling_interval_ - coarse_margin * coarse_factor;
+        auto measured_begin = st_begin + first * sampling_interval_;
+        auto measured_size = static_cast<std::int64_t>(coarse_footprint.size() + lags - 1);
+        auto coarse_measured = sample_mean(measured_raw_signal, measured_begin,
+                                           measured_begin + measured_size * coarse_interval,
+                                           coarse_interval);
+        auto average = std::accumulate(coarse_measured.begin(), coarse_measured.end(), 0.0) /
+                       coarse_measured.size();
+        for (auto& elem : coarse_measured)
+        {
+            elem -= average;
+        }
+
+        auto correlation = correlate_lags(coarse_footprint, coarse_measured, lags);
+        auto lobes = find_lobes(correlation.data(), correlation.size(),
+                                footprint_quantum_ / coarse_interval, false);
+        if (!lobes.finite)
+        {
+            throw std::runtime_error("Infinite value");
+        }
+        auto coarse_offset =
+            first + static_cast<std::int64_t>(lobes.mainlobe_index) * coarse_factor;
+
+        auto offset =
+            refine_offset(footprint, measured_raw_signal, coarse_offset, 2 * coarse_factor);
+        return { offset, lobes.mainlobe / lobes.sidelobe };
     }
 
 private:
     metricq::Duration sampling_interval_ = std::chrono::microseconds(5);
     int footprint_msequence_exponent_ = 11;
     metricq::Duration footprint_quantum_ = std::chrono::milliseconds(1);
+    metricq::Duration tolerance_ = std::chrono::seconds(2);
+    int footprint_threads_ = 1;
+    FootprintKernel footprint_kernel_ = FootprintKernel::scalar;
+    int footprint_granularity_ = 0;
+    SyncSearch search_ = SyncSearch::full;
+    bool single_precision_ = false;
+    bool adaptive_ = false;
+    double adaptive_threshold_ = 10.;
+    metricq::Duration adaptive_margin_ = std::chrono::milliseconds(100);
+    metricq::Duration adaptive_check_interval_ = std::chrono::milliseconds(250);
+    SyncMode mode_ = SyncMode::first;
+    metricq::Duration marker_interval_{}; // disabled
+    int marker_exponent_ = 8;
+    metricq::Duration marker_margin_ = std::chrono::milliseconds(100);
+    static constexpr double marker_threshold_ = 3.;
 
     std::unique_ptr<Footprint> footprint_begin_;
     std::unique_ptr<Footprint> footprint_end_;
 
-    double time_rate_;              // local time per measurement time
-    metricq::Duration offset_zero_; // diff between local time and measurement time
+    // completed markers in chronological order, only modified by the marker thread
+    std::vector<std::unique_ptr<Footprint>> markers_;
+    std::thread marker_thread_;
+    std::mutex marker_mutex_;
+    std::condition_variable marker_stop_cv_;
+    std::atomic<bool> marker_stop_{ false };
 };
 
 }; // namespace timesync
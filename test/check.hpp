@@ -0,0 +1,16 @@
+#pragma once
+
+#include <iostream>
+
+#include <cstdlib>
+
+// Unlike assert, also checks in release builds
+#define CHECK(condition)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(condition))                                                                          \
+        {                                                                                          \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n";        \
+            std::exit(1);                                                                          \
+        }                                                                                          \
+    } while (false)
@@ -0,0 +1,65 @@
+#include "check.hpp"
+
+#include "downsampler.hpp"
+#include "metric_store.hpp"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace
+{
+const double nan = std::numeric_limits<double>::quiet_NaN();
+
+std::vector<DownsampledValue> downsample(const DownsampleConfig& config,
+                                         const std::vector<double>& values)
+{
+    ChunkView chunk{ 0, 10, values.size(), nullptr, values.data() };
+    Downsampler downsampler(config);
+    std::vector<DownsampledValue> out;
+    downsampler.add(chunk, out);
+    downsampler.finish(out);
+    return out;
+}
+
+void test_minmax_nan_window(const DownsampleConfig& config)
+{
+    auto out = downsample(config, { 1., 5., 2., 3., nan, nan, nan, nan, 4., 0., 7., 7. });
+
+    CHECK(out.size() == 5);
+    CHECK(out[0].time_ns == 0 && out[0].value == 1.);
+    CHECK(out[1].time_ns == 10 && out[1].value == 5.);
+    // the NaN window keeps its own timestamp instead of the previous extremes
+    CHECK(out[2].time_ns == 40 && std::isnan(out[2].value));
+    CHECK(out[3].time_ns == 90 && out[3].value == 0.);
+    CHECK(out[4].time_ns == 100 && out[4].value == 7.);
+}
+
+void test_min_nan_window()
+{
+    DownsampleConfig config;
+    config.mode = DownsampleMode::min;
+    config.count = 4;
+    auto out = downsample(config, { 1., 5., 2., 3., nan, nan, nan, nan });
+
+    CHECK(out.size() == 2);
+    CHECK(out[0].value == 1.);
+    CHECK(std::isnan(out[1].value));
+}
+} // namespace
+
+int main()
+{
+    DownsampleConfig count;
+    count.mode = DownsampleMode::minmax;
+    count.count = 4;
+    test_minmax_nan_window(count);
+
+    DownsampleConfig interval;
+    interval.mode = DownsampleMode::minmax;
+    interval.interval_ns = 40;
+    test_minmax_nan_window(interval);
+
+    test_min_nan_window();
+    return 0;
+}
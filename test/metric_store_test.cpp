@@ -0,0 +1,103 @@
+#include "check.hpp"
+
+#include "metric_store.hpp"
+
+#include <metricq/types.hpp>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <unistd.h>
+
+namespace
+{
+metricq::TimeValue sample(std::int64_t time_ns, double value)
+{
+    return metricq::TimeValue(metricq::TimePoint(metricq::Duration(time_ns)), value);
+}
+
+// Chunks without offsets and without a fixed interval: a single sample, all samples at the same
+// time, and gaps that don't fit the 32 bit offsets in between
+std::vector<metricq::TimeValue> irregular_chunks()
+{
+    const std::int64_t gap = 10'000'000'000;
+    std::vector<metricq::TimeValue> samples;
+    samples.push_back(sample(0, 1.0));
+    for (int i = 0; i < 3; i++)
+    {
+        samples.push_back(sample(gap, 2.0 + i));
+    }
+    samples.push_back(sample(2 * gap, 5.0));
+    for (int i = 0; i < 5; i++)
+    {
+        samples.push_back(sample(3 * gap + i * 1000, 6.0 + i));
+    }
+    samples.push_back(sample(4 * gap, 11.0));
+    return samples;
+}
+
+void check_store(const MetricStore& store, const std::vector<metricq::TimeValue>& expected)
+{
+    CHECK(store.size() == expected.size());
+    std::size_t i = 0;
+    for (auto tv : store)
+    {
+        CHECK(tv.time == expected[i].time);
+        CHECK(tv.value == expected[i].value);
+        i++;
+    }
+    CHECK(i == expected.size());
+
+    i = 0;
+    store.for_each_chunk(
+        [&](const ChunkView& chunk)
+        {
+            for (std::size_t j = 0; j < chunk.size; j++, i++)
+            {
+                CHECK(chunk.time(j) == expected[i].time);
+                CHECK(chunk.values[j] == expected[i].value);
+            }
+        });
+    CHECK(i == expected.size());
+}
+
+void test_in_memory()
+{
+    auto samples = irregular_chunks();
+    MetricStore store;
+    store.append_all(samples);
+    store.seal();
+    CHECK(store.chunk_count() == 5);
+    check_store(store, samples);
+}
+
+void test_spilled()
+{
+    auto samples = irregular_chunks();
+
+    const char* tmpdir = std::getenv("TMPDIR");
+    std::string directory = std::string(tmpdir ? tmpdir : "/tmp") + "/metric_store_test.XXXXXX";
+    CHECK(mkdtemp(directory.data()) != nullptr);
+
+    {
+        MetricStore store;
+        store.spill_to(directory, "test/metric");
+        store.append_all(samples);
+        store.seal();
+        CHECK(store.chunk_count() == 5);
+        check_store(store, samples);
+    }
+    rmdir(directory.c_str());
+}
+} // namespace
+
+int main()
+{
+    test_in_memory();
+    test_spilled();
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include "check.hpp"
+
+#include "metric_store.hpp"
+#include "node_share.hpp"
+
+#include <metricq/types.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+const std::string url = "amqp://localhost";
+const std::vector<std::string> metrics = { "b", "a" };
+
+metricq::TimeValue sample(std::int64_t time_ns, double value)
+{
+    return metricq::TimeValue(metricq::TimePoint(metricq::Duration(time_ns)), value);
+}
+
+// A chunk with a fixed interval, one with offsets, a single sample and a constant timestamp
+std::vector<metricq::TimeValue> samples()
+{
+    const std::int64_t gap = 10'000'000'000;
+    std::vector<metricq::TimeValue> result;
+    for (int i = 0; i < 100; i++)
+    {
+        result.push_back(sample(i * 1000, i));
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        result.push_back(sample(gap + i * i * 1000, -i));
+    }
+    result.push_back(sample(2 * gap, 1.0));
+    for (int i = 0; i < 3; i++)
+    {
+        result.push_back(sample(3 * gap, 2.0 + i));
+    }
+    result.push_back(sample(4 * gap, 5.0));
+    return result;
+}
+
+void check_store(const MetricStore& store, const std::vector<metricq::TimeValue>& expected)
+{
+    CHECK(store.size() == expected.size());
+    std::size_t i = 0;
+    for (auto tv : store)
+    {
+        CHECK(tv.time == expected[i].time);
+        CHECK(tv.value == expected[i].value);
+        i++;
+    }
+}
+
+std::map<std::string, MetricStore> empty_data()
+{
+    std::map<std::string, MetricStore> data;
+    for (const auto& metric : metrics)
+    {
+        data[metric];
+    }
+    return data;
+}
+
+// One-way notification between processes
+class Pipe
+{
+public:
+    Pipe()
+    {
+        CHECK(pipe(fds_) == 0);
+    }
+
+    void notify()
+    {
+        char c = 0;
+        CHECK(write(fds_[1], &c, 1) == 1);
+    }
+
+    void wait()
+    {
+        char c;
+        CHECK(read(fds_[0], &c, 1) == 1);
+    }
+
+private:
+    int fds_[2];
+};
+
+template <typename F>
+pid_t spawn(F f)
+{
+    auto pid = fork();
+    CHECK(pid != -1);
+    if (pid == 0)
+    {
+        f();
+        std::exit(0);
+    }
+    return pid;
+}
+
+void check_success(pid_t pid)
+{
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+std::set<std::string> lock_files()
+{
+    std::set<std::string> result;
+    auto prefix = "scorep-metricq-" + std::to_string(getuid()) + "-";
+    auto* dir = opendir("/dev/shm");
+    CHECK(dir != nullptr);
+    while (auto* entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.compare(0, prefix.size(), prefix) == 0 && name.size() > 5 &&
+            name.compare(name.size() - 5, 5, ".lock") == 0)
+        {
+            result.insert("/dev/shm/" + name);
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+std::string unique_key(const char* name)
+{
+    return std::string("node_share_test-") + name + "-" + std::to_string(getpid());
+}
+
+// The leader subscribes and publishes, the followers only start after its subscription and get
+// the same data. No files are left behind.
+void test_share()
+{
+    const char* tmpdir = std::getenv("TMPDIR");
+    std::string directory = std::string(tmpdir ? tmpdir : "/tmp") + "/node_share_test.XXXXXX";
+    CHECK(mkdtemp(directory.data()) != nullptr);
+
+    auto key = unique_key("share");
+    auto files = lock_files();
+    auto* subscribed = new (mmap(nullptr, sizeof(std::atomic<bool>), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0)) std::atomic<bool>(false);
+    Pipe joined;
+
+    auto leader = spawn(
+        [&]()
+        {
+            auto data = empty_data();
+            data.at("a").spill_to(directory, "a");
+            NodeShare share;
+            share.join(url, metrics, key);
+            CHECK(share.role() == NodeRole::leader);
+            joined.notify();
+
+            // gives the followers time to wait for the subscription
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            subscribed->store(true);
+            share.announce_subscription();
+
+            for (auto& [name, store] : data)
+            {
+                store.append_all(samples());
+            }
+            share.wait_for_followers();
+            for (auto& [name, store] : data)
+            {
+                store.seal();
+            }
+            share.publish(data);
+        });
+    joined.wait();
+
+    std::vector<pid_t> followers;
+    for (int i = 0; i < 3; i++)
+    {
+        followers.push_back(spawn(
+            [&]()
+            {
+                auto data = empty_data();
+                NodeShare share;
+                share.join(url, metrics, key);
+                CHECK(share.role() == NodeRole::follower);
+                share.wait_for_subscription();
+                CHECK(subscribed->load());
+                CHECK(share.receive(data));
+                for (const auto& [name, store] : data)
+                {
+                    check_store(store, samples());
+                }
+            }));
+    }
+
+    check_success(leader);
+    for (auto follower : followers)
+    {
+        check_success(follower);
+    }
+    CHECK(lock_files() == files);
+    munmap(subscribed, sizeof(std::atomic<bool>));
+    rmdir(directory.c_str());
+}
+
+// Followers of a crashed leader get no data, not the data of an earlier leader with the same key
+void test_stale_data()
+{
+    auto key = unique_key("stale");
+    auto files = lock_files();
+
+    // a leader that crashes before publishing leaves its lock file behind
+    check_success(spawn(
+        [&]()
+        {
+            NodeShare share;
+            share.join(url, metrics, key);
+            CHECK(share.role() == NodeRole::leader);
+            _exit(0);
+        }));
+    auto lock_file = lock_files();
+    for (const auto& file : files)
+    {
+        lock_file.erase(file);
+    }
+    CHECK(lock_file.size() == 1);
+    auto prefix = lock_file.begin()->substr(0, lock_file.begin()->size() - 5);
+
+    // valid data without metrics, as from an earlier run of the group
+    {
+        auto fd = open((prefix + ".data").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        CHECK(fd != -1);
+        char header[40] = { 'M', 'Q', 'S', 'H', 'A', 'R', 'E', '\0', 2 };
+        header[24] = sizeof(header);
+        CHECK(write(fd, header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)));
+        close(fd);
+    }
+
+    Pipe joined;
+    Pipe received;
+    auto leader = spawn(
+        [&]()
+        {
+            NodeShare share;
+            share.join(url, metrics, key);
+            CHECK(share.role() == NodeRole::leader);
+            share.announce_subscription();
+            joined.notify();
+            received.wait();
+            _exit(0);
+        });
+    joined.wait();
+
+    auto follower = spawn(
+        [&]()
+        {
+            auto data = empty_data();
+            NodeShare share;
+            share.join(url, metrics, key);
+            CHECK(share.role() == NodeRole::follower);
+            share.wait_for_subscription();
+            received.notify();
+            CHECK(!share.receive(data));
+        });
+
+    check_success(leader);
+    check_success(follower);
+    CHECK(access((prefix + ".data").c_str(), F_OK) != 0);
+    unlink((prefix + ".lock").c_str());
+}
+} // namespace
+
+int main()
+{
+    test_share();
+    test_stale_data();
+    return 0;
+}